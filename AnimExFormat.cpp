@@ -1,8 +1,9 @@
 #include <algorithm>
 #include <cctype>
+#include <stdio.h>
 #include "mpanimbuild.h"
-#include "stb_image.h"
 #include "AnimExFormat.h"
+#include "FormatSelect.h"
 
 tinyxml2::XMLElement *AnimExFormat::GetFirstChildNode(tinyxml2::XMLElement *node)
 {
@@ -267,7 +268,10 @@ uint8_t AnimExFormat::GetTextureFormat(std::string id)
 			return format_ids[i];
 		}
 	}
-	return ANIMEX_TEX_FORMAT_RGBA8;
+	if (id == "AUTO") {
+		return ANIMEX_TEX_FORMAT_AUTO;
+	}
+	PrintError("Unknown texture format %s.\n", id.c_str());
 }
 
 void AnimExFormat::ReadTextures(std::string base_path, tinyxml2::XMLElement *root)
@@ -278,13 +282,32 @@ void AnimExFormat::ReadTextures(std::string base_path, tinyxml2::XMLElement *roo
 		const char *str_temp;
 		PrintXmlError(texture_node->QueryAttribute("name", &str_temp));
 		texture.name = str_temp;
+		str_temp = "RGBA8";
 		texture_node->QueryAttribute("format", &str_temp);
 		texture.format = GetTextureFormat(str_temp);
+		str_temp = "fast";
+		texture_node->QueryAttribute("cmpr_quality", &str_temp);
+		texture.cmpr_quality = ParseCmprQuality(str_temp);
 		PrintXmlError(texture_node->QueryAttribute("file", &str_temp));
 		std::string file_rel_path = str_temp;
 		std::string file_path = base_path + file_rel_path;
-		int channels;
-		texture.data = stbi_load(file_path.c_str(), &texture.w, &texture.h, &channels, 4);
+		texture.image = ImageCache::Load(file_path);
+		texture.w = texture.image->w;
+		texture.h = texture.image->h;
+		if (texture.format == ANIMEX_TEX_FORMAT_AUTO) {
+			std::string report;
+			texture.encoded = std::make_shared<EncodedTexture>();
+			uint8_t tex_format = FormatSelect::Choose(texture.w, texture.h, texture.image->data, texture.cmpr_quality, m_options, *texture.encoded, report);
+			texture.format = GetFileFormat(tex_format);
+			m_messages.push_back(texture.name + ": " + report);
+		}
+		str_temp = "";
+		texture_node->QueryAttribute("palette_group", &str_temp);
+		texture.palette_group = FindPaletteGroup(m_palette_groups, str_temp, GetEncodeFormat(texture.format));
+		//Palette group members are encoded together so the selection output can't be reused
+		if (texture.palette_group >= 0) {
+			texture.encoded.reset();
+		}
 		data.textures.push_back(texture);
 		texture_node = texture_node->NextSiblingElement("texture");
 	}
@@ -323,7 +346,7 @@ void AnimExFormat::AddImageReferences()
 	}
 }
 
-AnimExFormat::AnimExFormat(tinyxml2::XMLDocument *document, std::string base_path)
+AnimExFormat::AnimExFormat(tinyxml2::XMLDocument *document, std::string base_path, const EncodeOptions &options) : AnimFormat(options)
 {
 	tinyxml2::XMLElement *root = document->FirstChild()->ToElement();
 	data.length = 1;
@@ -364,9 +387,6 @@ AnimExFormat::~AnimExFormat()
 	for (size_t i = 0; i < data.images.size(); i++) {
 		delete data.images[i];
 	}
-	for (size_t i = 0; i < data.textures.size(); i++) {
-		stbi_image_free(data.textures[i].data);
-	}
 }
 
 uint32_t AnimExFormat::GetStringTableSize()
@@ -378,31 +398,70 @@ uint32_t AnimExFormat::GetStringTableSize()
 	return size;
 }
 
-void AnimExFormat::WriteNode(FILE *dst_file, AnimExNode *node)
+//Maps ANIMEX texture formats to the TEX_FORMAT_* used by the encoders
+uint8_t AnimExFormat::GetEncodeFormat(uint8_t format)
 {
-	WriteS16(dst_file, node->type);
-	WriteU16(dst_file, node->children.size());
-	uint32_t child_ofs = header.node_ref_ofs + (node->child_ref_idx * 4);
-	WriteU32(dst_file, child_ofs);
+	static const uint8_t encode_formats[ANIMEX_TEX_FORMAT_COUNT] = { TEX_FORMAT_RGBA8, TEX_FORMAT_RGB5A3, TEX_FORMAT_RGB5A3, TEX_FORMAT_CI8, TEX_FORMAT_CI4,
+			TEX_FORMAT_IA8, TEX_FORMAT_IA4, TEX_FORMAT_I8, TEX_FORMAT_I4, TEX_FORMAT_A8, TEX_FORMAT_CMPR };
+	return encode_formats[format];
 }
 
-void AnimExFormat::WriteTransforms(FILE *dst_file)
+uint8_t AnimExFormat::GetFileFormat(uint8_t tex_format)
 {
-	for (uint32_t i = 0; i < data.transforms.size(); i++) {
-		WriteNode(dst_file, &data.transforms[i]->node);
-		WriteFloat(dst_file, data.transforms[i]->scale_x);
-		WriteFloat(dst_file, data.transforms[i]->scale_y);
-		WriteFloat(dst_file, data.transforms[i]->scale_z);
-		WriteFloat(dst_file, data.transforms[i]->rot_x);
-		WriteFloat(dst_file, data.transforms[i]->rot_y);
-		WriteFloat(dst_file, data.transforms[i]->rot_z);
-		WriteFloat(dst_file, data.transforms[i]->pos_x);
-		WriteFloat(dst_file, data.transforms[i]->pos_x);
-		WriteFloat(dst_file, data.transforms[i]->pos_x);
-		for (uint32_t j = 0; j < 6; j++) {
-			WriteFloat(dst_file, 0.0f);
+	for (uint8_t i = 0; i < ANIMEX_TEX_FORMAT_COUNT; i++) {
+		if (GetEncodeFormat(i) == tex_format) {
+			return i;
 		}
 	}
+	return ANIMEX_TEX_FORMAT_RGBA8;
+}
+
+uint32_t AnimExFormat::GetPaletteSection(uint32_t index)
+{
+	return m_palette_sections[index];
+}
+
+uint32_t AnimExFormat::GetTexDataSection(uint32_t index)
+{
+	return m_data_sections[index];
+}
+
+std::vector<TextureSource> AnimExFormat::GetTextureSources()
+{
+	std::vector<TextureSource> sources;
+	for (uint32_t i = 0; i < data.textures.size(); i++) {
+		TextureSource source = { GetEncodeFormat(data.textures[i].format), data.textures[i].w, data.textures[i].h, data.textures[i].image->data, data.textures[i].cmpr_quality, data.textures[i].palette_group, data.textures[i].encoded.get() };
+		sources.push_back(source);
+	}
+	return sources;
+}
+
+void AnimExFormat::WriteNode(ByteWriter &writer, AnimExNode *node)
+{
+	writer.WriteS16(node->type);
+	writer.WriteU16(node->children.size());
+	uint32_t child_ofs = header.node_ref_ofs + (node->child_ref_idx * 4);
+	writer.WriteU32(child_ofs);
+}
+
+void AnimExFormat::WriteTransforms(ByteWriter &writer)
+{
+	m_layout.BeginSection(writer, ANIMEX_SECTION_TRANSFORMS);
+	for (uint32_t i = 0; i < data.transforms.size(); i++) {
+		WriteNode(writer, &data.transforms[i]->node);
+		writer.WriteFloat(data.transforms[i]->scale_x);
+		writer.WriteFloat(data.transforms[i]->scale_y);
+		writer.WriteFloat(data.transforms[i]->scale_z);
+		writer.WriteFloat(data.transforms[i]->rot_x);
+		writer.WriteFloat(data.transforms[i]->rot_y);
+		writer.WriteFloat(data.transforms[i]->rot_z);
+		writer.WriteFloat(data.transforms[i]->pos_x);
+		writer.WriteFloat(data.transforms[i]->pos_x);
+		writer.WriteFloat(data.transforms[i]->pos_x);
+		float padding[6] = { 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f };
+		writer.WriteFloatArray(padding, 6);
+	}
+	m_layout.EndSection(writer, ANIMEX_SECTION_TRANSFORMS);
 }
 
 int32_t AnimExFormat::GetTextureIdx(std::string name)
@@ -426,11 +485,12 @@ uint32_t AnimExFormat::GetStringOfs(std::string string)
 	return 0;
 }
 
-void AnimExFormat::WriteImages(FILE *dst_file)
+void AnimExFormat::WriteImages(ByteWriter &writer)
 {
+	m_layout.BeginSection(writer, ANIMEX_SECTION_IMAGES);
 	for (uint32_t i = 0; i < data.images.size(); i++) {
-		WriteNode(dst_file, &data.images[i]->node);
-		WriteU32(dst_file, GetStringOfs(data.images[i]->name) + header.str_table_ofs);
+		WriteNode(writer, &data.images[i]->node);
+		writer.WriteU32(GetStringOfs(data.images[i]->name) + header.str_table_ofs);
 		float vertices[12];
 		float uv[8];
 		vertices[2] = vertices[5] = vertices[8] = vertices[11] = 0;
@@ -438,55 +498,52 @@ void AnimExFormat::WriteImages(FILE *dst_file)
 		vertices[1] = vertices[4] = data.images[i]->y;
 		vertices[3] = vertices[6] = (vertices[0] + data.images[i]->w);
 		vertices[7] = vertices[10] = (vertices[1] + data.images[i]->h);
-		for (uint32_t i = 0; i < 12; i++) {
-			WriteFloat(dst_file, vertices[i]);
-		}
+		writer.WriteFloatArray(vertices, 12);
 		uv[0] = uv[6] = data.images[i]->uv_x;
 		uv[1] = uv[3] = data.images[i]->uv_y;
 		uv[2] = uv[4] = uv[0] + data.images[i]->uv_w;
 		uv[5] = uv[7] = uv[1] + data.images[i]->uv_h;
-		for (uint32_t i = 0; i < 8; i++) {
-			WriteFloat(dst_file, uv[i]);
-		}
-		WriteFloat(dst_file, data.images[i]->color[0]);
-		WriteFloat(dst_file, data.images[i]->color[1]);
-		WriteFloat(dst_file, data.images[i]->color[2]);
-		WriteFloat(dst_file, data.images[i]->color[3]);
+		writer.WriteFloatArray(uv, 8);
+		writer.WriteFloatArray(data.images[i]->color, 4);
 		int32_t tex_id = GetTextureIdx(data.images[i]->tex_name);
 		if (tex_id == -1) {
 			PrintError("Failed to find texture %s.\n", data.images[i]->tex_name.c_str());
 		}
-		WriteU32(dst_file, header.texture_ofs + (tex_id * 20));
+		writer.WriteU32(header.texture_ofs + (tex_id * 20));
 	}
+	m_layout.EndSection(writer, ANIMEX_SECTION_IMAGES);
 }
 
-void AnimExFormat::WriteTracks(FILE *dst_file)
+void AnimExFormat::WriteTracks(ByteWriter &writer)
 {
+	m_layout.BeginSection(writer, ANIMEX_SECTION_TRACKS);
 	for (uint32_t i = 0; i < data.tracks.size(); i++) {
-		WriteS16(dst_file, data.tracks[i].node_type);
-		WriteU16(dst_file, data.tracks[i].node_id);
-		WriteU16(dst_file, data.tracks[i].track_type);
-		WriteU16(dst_file, data.tracks[i].var_id);
-		WriteU32(dst_file, data.tracks[i].keyframes.size());
+		writer.WriteS16(data.tracks[i].node_type);
+		writer.WriteU16(data.tracks[i].node_id);
+		writer.WriteU16(data.tracks[i].track_type);
+		writer.WriteU16(data.tracks[i].var_id);
+		writer.WriteU32(data.tracks[i].keyframes.size());
 		uint32_t keyframe_ofs = header.keyframe_ofs + (data.tracks[i].keyframe_start * 24);
-		WriteU32(dst_file, keyframe_ofs);
+		writer.WriteU32(keyframe_ofs);
 	}
+	m_layout.EndSection(writer, ANIMEX_SECTION_TRACKS);
 }
 
-void AnimExFormat::WriteKeyframes(FILE *dst_file)
+void AnimExFormat::WriteKeyframes(ByteWriter &writer)
 {
+	m_layout.BeginSection(writer, ANIMEX_SECTION_KEYFRAMES);
 	for (uint32_t i = 0; i < data.keyframes.size(); i++) {
-		WriteU32(dst_file, data.keyframes[i].interp_type);
-		WriteU32(dst_file, data.keyframes[i].frame_num);
-		WriteFloat(dst_file, data.keyframes[i].points[0]);
-		WriteFloat(dst_file, data.keyframes[i].points[1]);
-		WriteFloat(dst_file, data.keyframes[i].points[2]);
-		WriteFloat(dst_file, data.keyframes[i].points[3]);
+		writer.WriteU32(data.keyframes[i].interp_type);
+		writer.WriteU32(data.keyframes[i].frame_num);
+		writer.WriteFloatArray(data.keyframes[i].points, 4);
 	}
+	m_layout.EndSection(writer, ANIMEX_SECTION_KEYFRAMES);
 }
 
-void AnimExFormat::WriteNodeReferences(FILE *dst_file)
+void AnimExFormat::WriteNodeReferences(ByteWriter &writer)
 {
+	m_layout.BeginSection(writer, ANIMEX_SECTION_NODE_REFS);
+	std::vector<uint32_t> node_ofs_list(data.node_references.size());
 	for (uint32_t i = 0; i < data.node_references.size(); i++) {
 		uint32_t node_ofs = 0;
 		switch (data.node_references[i]->type) {
@@ -509,108 +566,160 @@ void AnimExFormat::WriteNodeReferences(FILE *dst_file)
 			default:
 				break;
 		}
-		WriteU32(dst_file, node_ofs);
+		node_ofs_list[i] = node_ofs;
 	}
+	writer.WriteU32Array(node_ofs_list.data(), node_ofs_list.size());
+	m_layout.EndSection(writer, ANIMEX_SECTION_NODE_REFS);
 }
 
-void AnimExFormat::WriteBanks(FILE *dst_file)
+void AnimExFormat::WriteBanks(ByteWriter &writer)
 {
-	for (uint32_t i = 0; i < data.bank_frame_starts.size(); i++) {
-		WriteU32(dst_file, data.bank_frame_starts[i]);
-	}
+	m_layout.BeginSection(writer, ANIMEX_SECTION_FRAME_STARTS);
+	writer.WriteU32Array(data.bank_frame_starts.data(), data.bank_frame_starts.size());
+	m_layout.EndSection(writer, ANIMEX_SECTION_FRAME_STARTS);
 }
 
-void AnimExFormat::WriteStringTable(FILE *dst_file)
+void AnimExFormat::WriteStringTable(ByteWriter &writer)
 {
+	m_layout.BeginSection(writer, ANIMEX_SECTION_STRINGS);
 	for (uint32_t i = 0; i < data.strings.size(); i++) {
 		const char *string = data.strings[i].data.c_str();
-		fwrite(string, 1, data.strings[i].data.length()+1, dst_file);
-	}
-	if (ftell(dst_file) % 4) {
-		uint32_t value = 0;
-		fwrite(&value, 1, 4-(ftell(dst_file) % 4), dst_file);
+		writer.WriteBytes(string, data.strings[i].data.length()+1);
 	}
+	m_layout.EndSection(writer, ANIMEX_SECTION_STRINGS);
 }
 
-void AnimExFormat::WriteTextures(FILE *dst_file)
+void AnimExFormat::WriteTextures(ByteWriter &writer)
 {
-	uint8_t lookup_fmt[ANIMEX_TEX_FORMAT_COUNT] = { TEX_FORMAT_RGBA8, TEX_FORMAT_RGB5A3, TEX_FORMAT_RGB5A3, TEX_FORMAT_CI8, TEX_FORMAT_CI4,
-			TEX_FORMAT_IA8, TEX_FORMAT_IA4, TEX_FORMAT_I8, TEX_FORMAT_I4, TEX_FORMAT_A8, TEX_FORMAT_CMPR };
-	uint32_t pal_ofs = header.texture_ofs + (20 * data.textures.size());
-	pal_ofs = (pal_ofs + 31) & 0xFFFFFFE0;
+	m_layout.BeginSection(writer, ANIMEX_SECTION_TEXTURES);
 	for (uint32_t i = 0; i < data.textures.size(); i++) {
-		uint8_t bpp_table[ANIMEX_TEX_FORMAT_COUNT] = { 32, 16, 16, 8, 4, 16, 8, 8, 4, 8, 4 };
-		uint32_t tex_ofs = pal_ofs;
-		WriteU8(dst_file, bpp_table[data.textures[i].format]);
-		WriteU8(dst_file, data.textures[i].format);
-		if (data.textures[i].format == ANIMEX_TEX_FORMAT_CI8 || data.textures[i].format == ANIMEX_TEX_FORMAT_CI4) {
-			tex_ofs += 2 << bpp_table[data.textures[i].format];
-		}
+		writer.WriteU8(GetTexBpp(GetEncodeFormat(data.textures[i].format)));
+		writer.WriteU8(data.textures[i].format);
 		if (data.textures[i].format == ANIMEX_TEX_FORMAT_CI8 || data.textures[i].format == ANIMEX_TEX_FORMAT_CI8) {
-			WriteS16(dst_file, 1 << bpp_table[data.textures[i].format]);
+			writer.WriteS16(1 << GetTexBpp(GetEncodeFormat(data.textures[i].format)));
 		} else {
-			WriteS16(dst_file, 0);
+			writer.WriteS16(0);
+		}
+		writer.WriteS16(data.textures[i].w);
+		writer.WriteS16(data.textures[i].h);
+		writer.WriteU32(m_layout.GetSize(GetTexDataSection(i)));
+		writer.WriteU32(m_layout.GetOffset(GetPaletteSection(i)));
+		writer.WriteU32(m_layout.GetOffset(GetTexDataSection(i)));
+	}
+	m_layout.EndSection(writer, ANIMEX_SECTION_TEXTURES);
+	m_layout.BeginSection(writer, ANIMEX_SECTION_TEXTURE_DATA);
+	m_layout.EndSection(writer, ANIMEX_SECTION_TEXTURE_DATA);
+	std::vector<TextureSource> all_sources = GetTextureSources();
+	std::vector<TextureSource> sources;
+	for (uint32_t i = 0; i < all_sources.size(); i++) {
+		if (m_texture_owners[i] == i) {
+			sources.push_back(all_sources[i]);
 		}
-		WriteS16(dst_file, data.textures[i].w);
-		WriteS16(dst_file, data.textures[i].h);
-
-		uint8_t cur_lookup_fmt = lookup_fmt[data.textures[i].format];
-		uint32_t data_size = GetTexDataSize(cur_lookup_fmt, data.textures[i].w, data.textures[i].h);
-		WriteU32(dst_file, data_size);
-		WriteU32(dst_file, pal_ofs);
-		WriteU32(dst_file, tex_ofs);
-		pal_ofs = tex_ofs + data_size;
 	}
-	AlignFile32(dst_file);
-	for (uint32_t i = 0; i < data.textures.size(); i++) {
-		TextureWrite(dst_file, lookup_fmt[data.textures[i].format], data.textures[i].w, data.textures[i].h, data.textures[i].data);
-	}
-}
-void AnimExFormat::WriteData(FILE *dst_file)
-{
-	WriteU32(dst_file, 0x414E494D);
-	WriteS16(dst_file, 1);
-	WriteS16(dst_file, 0);
-	WriteU32(dst_file, data.length);
-	WriteU32(dst_file, 0);
-	WriteU32(dst_file, 1);
-	WriteU32(dst_file, 1);
-	WriteU32(dst_file, data.transforms.size());
-	WriteU32(dst_file, data.images.size());
-	WriteU32(dst_file, data.tracks.size());
-	WriteU32(dst_file, data.keyframes.size());
-	WriteU32(dst_file, data.textures.size());
-	WriteU32(dst_file, data.node_references.size());
-	WriteU32(dst_file, data.bank_frame_starts.size());
-	WriteU32(dst_file, GetStringTableSize());
-	header.root_ofs = 96;
-	WriteU32(dst_file, header.root_ofs);
-	header.type1_ofs = header.root_ofs + 8;
-	WriteU32(dst_file, header.type1_ofs);
-	header.transform_ofs = header.type1_ofs + 8;
-	WriteU32(dst_file, header.transform_ofs);
-	header.image_ofs = header.transform_ofs + (data.transforms.size() * 68);
-	WriteU32(dst_file, header.image_ofs);
-	header.track_ofs = header.image_ofs + (data.images.size() * 112);
-	WriteU32(dst_file, header.track_ofs);
-	header.keyframe_ofs = header.track_ofs + (data.tracks.size() * 16);
-	WriteU32(dst_file, header.keyframe_ofs);
-	header.node_ref_ofs = header.keyframe_ofs + (data.keyframes.size() * 24);
-	header.frame_start_ofs = header.node_ref_ofs + (data.node_references.size() * 4);
-	header.str_table_ofs = header.frame_start_ofs + (data.bank_frame_starts.size() * 4);
-	header.texture_ofs = (header.str_table_ofs + GetStringTableSize() + 3) & 0xFFFFFFFC;
-	WriteU32(dst_file, header.texture_ofs);
-	WriteU32(dst_file, header.node_ref_ofs);
-	WriteU32(dst_file, header.frame_start_ofs);
-	WriteU32(dst_file, header.str_table_ofs);
-	WriteNode(dst_file, data.root);
-	WriteNode(dst_file, data.type1);
-	WriteTransforms(dst_file);
-	WriteImages(dst_file);
-	WriteTracks(dst_file);
-	WriteKeyframes(dst_file);
-	WriteNodeReferences(dst_file);
-	WriteBanks(dst_file);
-	WriteStringTable(dst_file);
-	WriteTextures(dst_file);
+	TextureWriteAll(writer, sources, m_options);
+	m_layout.EndSection(writer, m_layout.GetSectionCount() - 1);
+}
+
+void AnimExFormat::PlanLayout()
+{
+	m_layout.Clear();
+	m_layout.AddSection("header", 96);
+	m_layout.AddSection("root", 8);
+	m_layout.AddSection("type1", 8);
+	m_layout.AddSection("transforms", data.transforms.size() * 68);
+	m_layout.AddSection("images", data.images.size() * 112);
+	m_layout.AddSection("tracks", data.tracks.size() * 16);
+	m_layout.AddSection("keyframes", data.keyframes.size() * 24);
+	m_layout.AddSection("node references", data.node_references.size() * 4);
+	m_layout.AddSection("frame starts", data.bank_frame_starts.size() * 4);
+	m_layout.AddSection("string table", GetStringTableSize());
+	m_layout.AddSection("textures", data.textures.size() * 20, 4, 0);
+	//Texture data is padded out to 32 bytes even when there are no textures
+	m_layout.AddSection("texture data", 0, 32, 0x88);
+	std::vector<TextureSource> sources = GetTextureSources();
+	m_texture_owners = FindDuplicateTextures(sources);
+	m_palette_sections.resize(sources.size());
+	m_data_sections.resize(sources.size());
+	PaletteGroupSections group_palettes = {};
+	uint32_t num_shared = 0;
+	uint32_t saved_size = 0;
+	for (uint32_t i = 0; i < sources.size(); i++) {
+		uint32_t pal_size = GetTexPalSize(sources[i].format);
+		uint32_t tex_size = GetTexDataSize(sources[i].format, sources[i].w, sources[i].h);
+		//Duplicate textures point at the sections of the first texture with the same payload
+		if (m_texture_owners[i] != i) {
+			m_palette_sections[i] = m_palette_sections[m_texture_owners[i]];
+			m_data_sections[i] = m_data_sections[m_texture_owners[i]];
+			num_shared++;
+			saved_size += pal_size + tex_size;
+			continue;
+		}
+		m_palette_sections[i] = PlanPaletteSection(m_layout, sources, i, data.textures[i].name + " palette", group_palettes);
+		m_data_sections[i] = m_layout.AddSection(data.textures[i].name, tex_size);
+	}
+	if (num_shared != 0) {
+		char message[128];
+		snprintf(message, sizeof(message), "Shared texture data of %u duplicate textures, saving %u bytes.", num_shared, saved_size);
+		m_messages.push_back(message);
+	}
+	if (group_palettes.num_shared != 0) {
+		char message[128];
+		snprintf(message, sizeof(message), "Shared %u palettes within palette groups, saving %u bytes.", group_palettes.num_shared, group_palettes.saved_size);
+		m_messages.push_back(message);
+	}
+	header.root_ofs = m_layout.GetOffset(ANIMEX_SECTION_ROOT);
+	header.type1_ofs = m_layout.GetOffset(ANIMEX_SECTION_TYPE1);
+	header.transform_ofs = m_layout.GetOffset(ANIMEX_SECTION_TRANSFORMS);
+	header.image_ofs = m_layout.GetOffset(ANIMEX_SECTION_IMAGES);
+	header.track_ofs = m_layout.GetOffset(ANIMEX_SECTION_TRACKS);
+	header.keyframe_ofs = m_layout.GetOffset(ANIMEX_SECTION_KEYFRAMES);
+	header.node_ref_ofs = m_layout.GetOffset(ANIMEX_SECTION_NODE_REFS);
+	header.frame_start_ofs = m_layout.GetOffset(ANIMEX_SECTION_FRAME_STARTS);
+	header.str_table_ofs = m_layout.GetOffset(ANIMEX_SECTION_STRINGS);
+	header.texture_ofs = m_layout.GetOffset(ANIMEX_SECTION_TEXTURES);
+}
+
+void AnimExFormat::WriteData(ByteWriter &writer)
+{
+	m_layout.BeginSection(writer, ANIMEX_SECTION_HEADER);
+	writer.WriteU32(0x414E494D);
+	writer.WriteS16(1);
+	writer.WriteS16(0);
+	writer.WriteU32(data.length);
+	writer.WriteU32(0);
+	writer.WriteU32(1);
+	writer.WriteU32(1);
+	writer.WriteU32(data.transforms.size());
+	writer.WriteU32(data.images.size());
+	writer.WriteU32(data.tracks.size());
+	writer.WriteU32(data.keyframes.size());
+	writer.WriteU32(data.textures.size());
+	writer.WriteU32(data.node_references.size());
+	writer.WriteU32(data.bank_frame_starts.size());
+	writer.WriteU32(GetStringTableSize());
+	writer.WriteU32(header.root_ofs);
+	writer.WriteU32(header.type1_ofs);
+	writer.WriteU32(header.transform_ofs);
+	writer.WriteU32(header.image_ofs);
+	writer.WriteU32(header.track_ofs);
+	writer.WriteU32(header.keyframe_ofs);
+	writer.WriteU32(header.texture_ofs);
+	writer.WriteU32(header.node_ref_ofs);
+	writer.WriteU32(header.frame_start_ofs);
+	writer.WriteU32(header.str_table_ofs);
+	m_layout.EndSection(writer, ANIMEX_SECTION_HEADER);
+	m_layout.BeginSection(writer, ANIMEX_SECTION_ROOT);
+	WriteNode(writer, data.root);
+	m_layout.EndSection(writer, ANIMEX_SECTION_ROOT);
+	m_layout.BeginSection(writer, ANIMEX_SECTION_TYPE1);
+	WriteNode(writer, data.type1);
+	m_layout.EndSection(writer, ANIMEX_SECTION_TYPE1);
+	WriteTransforms(writer);
+	WriteImages(writer);
+	WriteTracks(writer);
+	WriteKeyframes(writer);
+	WriteNodeReferences(writer);
+	WriteBanks(writer);
+	WriteStringTable(writer);
+	WriteTextures(writer);
 }
\ No newline at end of file
@@ -1,6 +1,8 @@
 #pragma once
 #include "AnimFormat.h"
 
+#include "ImageCache.h"
+#include "mpanimbuild.h"
 #include "tinyxml2.h"
 #include <string>
 #include <vector>
@@ -17,6 +19,23 @@
 #define ANIMEX_TEX_FORMAT_A8 9
 #define ANIMEX_TEX_FORMAT_CMPR 10
 #define ANIMEX_TEX_FORMAT_COUNT 11
+//Replaced by the format FormatSelect picks once the image is loaded
+#define ANIMEX_TEX_FORMAT_AUTO 0xFF
+
+#define ANIMEX_SECTION_HEADER 0
+#define ANIMEX_SECTION_ROOT 1
+#define ANIMEX_SECTION_TYPE1 2
+#define ANIMEX_SECTION_TRANSFORMS 3
+#define ANIMEX_SECTION_IMAGES 4
+#define ANIMEX_SECTION_TRACKS 5
+#define ANIMEX_SECTION_KEYFRAMES 6
+#define ANIMEX_SECTION_NODE_REFS 7
+#define ANIMEX_SECTION_FRAME_STARTS 8
+#define ANIMEX_SECTION_STRINGS 9
+#define ANIMEX_SECTION_TEXTURES 10
+#define ANIMEX_SECTION_TEXTURE_DATA 11
+//Each texture then gets a palette section followed by a tile data section
+#define ANIMEX_SECTION_COUNT 12
 
 #define ANIMEX_NODE_TYPE_ROOT 0
 #define ANIMEX_NODE_TYPE_TRANSFORM 2
@@ -41,10 +60,14 @@
 
 struct AnimExTexture {
 	uint8_t format;
+	uint8_t cmpr_quality;
 	std::string name;
 	int w;
 	int h;
-	uint8_t *data;
+	std::shared_ptr<DecodedImage> image;
+	int32_t palette_group;
+	//Output of format="auto" selection, null for other textures
+	std::shared_ptr<EncodedTexture> encoded;
 };
 
 struct AnimExNode {
@@ -147,11 +170,12 @@ typedef struct animex_header {
 class AnimExFormat : public AnimFormat
 {
 public:
-	AnimExFormat(tinyxml2::XMLDocument *document, std::string base_path);
+	AnimExFormat(tinyxml2::XMLDocument *document, std::string base_path, const EncodeOptions &options);
 	~AnimExFormat();
 
 public:
-	virtual void WriteData(FILE *dst_file);
+	virtual void PlanLayout();
+	virtual void WriteData(ByteWriter &writer);
 
 private:
 	void ReadNode(tinyxml2::XMLElement *node, AnimExNode *parent);
@@ -163,16 +187,22 @@ private:
 	void AddNodeReference(AnimExNode *node);
 	void AddTransformReferences();
 	void AddImageReferences();
-	void WriteNode(FILE *dst_file, AnimExNode *node);
-	void WriteTransforms(FILE *dst_file);
-	void WriteImages(FILE *dst_file);
-	void WriteTracks(FILE *dst_file);
-	void WriteKeyframes(FILE *dst_file);
-	void WriteNodeReferences(FILE *dst_file);
-	void WriteBanks(FILE *dst_file);
-	void WriteStringTable(FILE *dst_file);
-	void WriteTextures(FILE *dst_file);
+	void WriteNode(ByteWriter &writer, AnimExNode *node);
+	void WriteTransforms(ByteWriter &writer);
+	void WriteImages(ByteWriter &writer);
+	void WriteTracks(ByteWriter &writer);
+	void WriteKeyframes(ByteWriter &writer);
+	void WriteNodeReferences(ByteWriter &writer);
+	void WriteBanks(ByteWriter &writer);
+	void WriteStringTable(ByteWriter &writer);
+	void WriteTextures(ByteWriter &writer);
 	uint32_t GetStringTableSize();
+	uint8_t GetEncodeFormat(uint8_t format);
+	//Inverse of GetEncodeFormat
+	uint8_t GetFileFormat(uint8_t tex_format);
+	uint32_t GetPaletteSection(uint32_t index);
+	uint32_t GetTexDataSection(uint32_t index);
+	std::vector<TextureSource> GetTextureSources();
 	int32_t GetTransformIdx(std::string name);
 	int32_t GetImageIdx(std::string name);
 	int32_t GetTextureIdx(std::string name);
@@ -186,5 +216,9 @@ private:
 	AnimExData data;
 	AnimExHeader header;
 	uint32_t m_node_idx;
+	std::vector<PaletteGroup> m_palette_groups;
+	std::vector<uint32_t> m_texture_owners;
+	std::vector<uint32_t> m_palette_sections;
+	std::vector<uint32_t> m_data_sections;
 };
 
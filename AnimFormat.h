@@ -1,10 +1,35 @@
 #pragma once
 
-#include <stdio.h>
+#include <string>
+#include <vector>
+#include "ByteWriter.h"
+#include "LayoutPlan.h"
+#include "mpanimbuild.h"
 
 class AnimFormat
 {
 public:
-	virtual void WriteData(FILE *dst_file) = 0;
+	AnimFormat(const EncodeOptions &options) : m_options(options) {}
+	virtual ~AnimFormat() {}
+	//Fills in the layout of every section, must be called before WriteData
+	virtual void PlanLayout() = 0;
+	virtual void WriteData(ByteWriter &writer) = 0;
+
+	LayoutPlan &GetLayout()
+	{
+		return m_layout;
+	}
+
+	//Notes for the build log such as the formats picked for format="auto" textures
+	std::vector<std::string> &GetMessages()
+	{
+		return m_messages;
+	}
+
+protected:
+	//Settings of the build this file is part of
+	EncodeOptions m_options;
+	LayoutPlan m_layout;
+	std::vector<std::string> m_messages;
 };
 
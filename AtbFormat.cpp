@@ -1,8 +1,9 @@
 #include <algorithm>
 #include <cctype>
+#include <stdio.h>
 #include "AtbFormat.h"
 #include "mpanimbuild.h"
-#include "stb_image.h"
+#include "FormatSelect.h"
 
 void AtbFormat::ParseBanks(tinyxml2::XMLNode *node)
 {
@@ -75,7 +76,10 @@ uint8_t GetTextureFormat(std::string format)
 			return format_ids[i];
 		}
 	}
-	return ATB_TEX_FORMAT_RGBA8;
+	if (format == "AUTO") {
+		return ATB_TEX_FORMAT_AUTO;
+	}
+	PrintError("Unknown texture format %s.\n", format.c_str());
 }
 
 void AtbFormat::ParseTextures(std::string base_path, tinyxml2::XMLNode *node)
@@ -89,17 +93,35 @@ void AtbFormat::ParseTextures(std::string base_path, tinyxml2::XMLNode *node)
 		str_temp = "RGBA8";
 		texture_node->QueryAttribute("format", &str_temp);
 		texture.format = GetTextureFormat(str_temp);
+		str_temp = "fast";
+		texture_node->QueryAttribute("cmpr_quality", &str_temp);
+		texture.cmpr_quality = ParseCmprQuality(str_temp);
 		PrintXmlError(texture_node->QueryAttribute("file", &str_temp));
 		std::string file_rel_path = str_temp;
 		std::string file_path = base_path + file_rel_path;
-		int channels;
-		texture.image_data = stbi_load(file_path.c_str(), &texture.w, &texture.h, &channels, 4);
+		texture.image = ImageCache::Load(file_path);
+		texture.w = texture.image->w;
+		texture.h = texture.image->h;
+		if (texture.format == ATB_TEX_FORMAT_AUTO) {
+			std::string report;
+			texture.encoded = std::make_shared<EncodedTexture>();
+			uint8_t tex_format = FormatSelect::Choose(texture.w, texture.h, texture.image->data, texture.cmpr_quality, m_options, *texture.encoded, report);
+			texture.format = GetFileFormat(tex_format);
+			m_messages.push_back(texture.name + ": " + report);
+		}
+		str_temp = "";
+		texture_node->QueryAttribute("palette_group", &str_temp);
+		texture.palette_group = FindPaletteGroup(m_palette_groups, str_temp, GetEncodeFormat(texture.format));
+		//Palette group members are encoded together so the selection output can't be reused
+		if (texture.palette_group >= 0) {
+			texture.encoded.reset();
+		}
 		m_texture_list.push_back(texture);
 		texture_node = texture_node->NextSiblingElement("texture");
 	}
 }
 
-AtbFormat::AtbFormat(tinyxml2::XMLDocument *document, std::string base_path)
+AtbFormat::AtbFormat(tinyxml2::XMLDocument *document, std::string base_path, const EncodeOptions &options) : AnimFormat(options)
 {
 	tinyxml2::XMLNode *root = document->FirstChild();
 	tinyxml2::XMLNode *bank = root->FirstChildElement("banks");
@@ -121,27 +143,62 @@ AtbFormat::AtbFormat(tinyxml2::XMLDocument *document, std::string base_path)
 
 AtbFormat::~AtbFormat()
 {
-	for (size_t i = 0; i < m_texture_list.size(); i++) {
-		stbi_image_free(m_texture_list[i].image_data);
-	}
 }
 
-uint32_t AtbFormat::GetPatternSize()
+uint32_t AtbFormat::GetLayerCount()
 {
-	uint32_t pattern_size = m_pattern_list.size() * 16;
+	uint32_t layer_count = 0;
 	for (uint32_t i = 0; i < m_pattern_list.size(); i++) {
-		pattern_size += 32 * m_pattern_list[i].layers.size();
+		layer_count += m_pattern_list[i].layers.size();
 	}
-	return pattern_size;
+	return layer_count;
 }
 
-uint32_t AtbFormat::GetBankSize()
+uint32_t AtbFormat::GetFrameCount()
 {
-	uint32_t bank_size = m_bank_list.size() * 8;
+	uint32_t frame_count = 0;
 	for (uint32_t i = 0; i < m_bank_list.size(); i++) {
-		bank_size += 12 * m_bank_list[i].frames.size();
+		frame_count += m_bank_list[i].frames.size();
+	}
+	return frame_count;
+}
+
+//Maps ATB texture formats to the TEX_FORMAT_* used by the encoders
+uint8_t AtbFormat::GetEncodeFormat(uint8_t format)
+{
+	static const uint8_t encode_formats[ATB_TEX_FORMAT_COUNT] = { TEX_FORMAT_RGBA8, TEX_FORMAT_RGB5A3, TEX_FORMAT_RGB5A3, TEX_FORMAT_CI8, TEX_FORMAT_CI4,
+			TEX_FORMAT_IA8, TEX_FORMAT_IA4, TEX_FORMAT_I8, TEX_FORMAT_I4, TEX_FORMAT_A8, TEX_FORMAT_CMPR };
+	return encode_formats[format];
+}
+
+uint8_t AtbFormat::GetFileFormat(uint8_t tex_format)
+{
+	for (uint8_t i = 0; i < ATB_TEX_FORMAT_COUNT; i++) {
+		if (GetEncodeFormat(i) == tex_format) {
+			return i;
+		}
+	}
+	return ATB_TEX_FORMAT_RGBA8;
+}
+
+uint32_t AtbFormat::GetPaletteSection(uint32_t index)
+{
+	return m_palette_sections[index];
+}
+
+uint32_t AtbFormat::GetTexDataSection(uint32_t index)
+{
+	return m_data_sections[index];
+}
+
+std::vector<TextureSource> AtbFormat::GetTextureSources()
+{
+	std::vector<TextureSource> sources;
+	for (uint32_t i = 0; i < m_texture_list.size(); i++) {
+		TextureSource source = { GetEncodeFormat(m_texture_list[i].format), m_texture_list[i].w, m_texture_list[i].h, m_texture_list[i].image->data, m_texture_list[i].cmpr_quality, m_texture_list[i].palette_group, m_texture_list[i].encoded.get() };
+		sources.push_back(source);
 	}
-	return bank_size;
+	return sources;
 }
 
 int32_t AtbFormat::SearchTexture(std::string name)
@@ -164,22 +221,25 @@ int32_t AtbFormat::SearchPattern(std::string name)
 	return -1;
 }
 
-void AtbFormat::WritePatterns(FILE *file)
+void AtbFormat::WritePatterns(ByteWriter &writer)
 {
-	uint32_t layer_ofs = m_pattern_ofs + (m_pattern_list.size() * 16);
+	uint32_t layer_ofs = m_layout.GetOffset(ATB_SECTION_LAYERS);
+	m_layout.BeginSection(writer, ATB_SECTION_PATTERNS);
 	for (uint32_t i = 0; i < m_pattern_list.size(); i++) {
-		WriteS16(file, m_pattern_list[i].layers.size());
-		WriteS16(file, m_pattern_list[i].center_x);
-		WriteS16(file, m_pattern_list[i].center_y);
-		WriteS16(file, m_pattern_list[i].w);
-		WriteS16(file, m_pattern_list[i].h);
-		WriteS16(file, 0);
-		WriteU32(file, layer_ofs);
+		writer.WriteS16(m_pattern_list[i].layers.size());
+		writer.WriteS16(m_pattern_list[i].center_x);
+		writer.WriteS16(m_pattern_list[i].center_y);
+		writer.WriteS16(m_pattern_list[i].w);
+		writer.WriteS16(m_pattern_list[i].h);
+		writer.WriteS16(0);
+		writer.WriteU32(layer_ofs);
 		layer_ofs += 32 * m_pattern_list[i].layers.size();
 	}
+	m_layout.EndSection(writer, ATB_SECTION_PATTERNS);
+	m_layout.BeginSection(writer, ATB_SECTION_LAYERS);
 	for (uint32_t i = 0; i < m_pattern_list.size(); i++) {
 		for (uint32_t j = 0; j < m_pattern_list[i].layers.size(); j++) {
-			WriteU8(file, m_pattern_list[i].layers[j].alpha);
+			writer.WriteU8(m_pattern_list[i].layers[j].alpha);
 			uint8_t flip_flags = 0;
 			if (m_pattern_list[i].layers[j].flip_x) {
 				flip_flags |= 1;
@@ -187,103 +247,145 @@ void AtbFormat::WritePatterns(FILE *file)
 			if (m_pattern_list[i].layers[j].flip_y) {
 				flip_flags |= 2;
 			}
-			WriteU8(file, flip_flags);
+			writer.WriteU8(flip_flags);
 			int32_t tex_idx = SearchTexture(m_pattern_list[i].layers[j].tex_name);
 			if (tex_idx == -1) {
 				PrintError("Texture %s doesn't exist.\n", m_pattern_list[i].layers[j].tex_name.c_str());
 			}
-			WriteS16(file, tex_idx);
-			WriteS16(file, m_pattern_list[i].layers[j].src_x);
-			WriteS16(file, m_pattern_list[i].layers[j].src_y);
-			WriteS16(file, m_pattern_list[i].layers[j].w);
-			WriteS16(file, m_pattern_list[i].layers[j].h);
-			WriteS16(file, m_pattern_list[i].layers[j].shift_x);
-			WriteS16(file, m_pattern_list[i].layers[j].shift_y);
+			writer.WriteS16(tex_idx);
+			writer.WriteS16(m_pattern_list[i].layers[j].src_x);
+			writer.WriteS16(m_pattern_list[i].layers[j].src_y);
+			writer.WriteS16(m_pattern_list[i].layers[j].w);
+			writer.WriteS16(m_pattern_list[i].layers[j].h);
+			writer.WriteS16(m_pattern_list[i].layers[j].shift_x);
+			writer.WriteS16(m_pattern_list[i].layers[j].shift_y);
 			int16_t vertices[8];
 			vertices[6] = vertices[0] = m_pattern_list[i].layers[j].shift_x;
 			vertices[3] = vertices[1] = m_pattern_list[i].layers[j].shift_y;
 			vertices[2] = vertices[4] = vertices[0] + m_pattern_list[i].layers[j].w;
 			vertices[5] = vertices[7] = vertices[1] + m_pattern_list[i].layers[j].h;
-			for (int16_t i = 0; i < 8; i++) {
-				WriteS16(file, vertices[i]);
-			}
+			writer.WriteS16Array(vertices, 8);
 		}
 	}
+	m_layout.EndSection(writer, ATB_SECTION_LAYERS);
 }
 
-void AtbFormat::WriteBanks(FILE *file)
+void AtbFormat::WriteBanks(ByteWriter &writer)
 {
-	uint32_t frame_ofs = m_bank_ofs + (m_bank_list.size() * 8);
+	uint32_t frame_ofs = m_layout.GetOffset(ATB_SECTION_FRAMES);
+	m_layout.BeginSection(writer, ATB_SECTION_BANKS);
 	for (uint32_t i = 0; i < m_bank_list.size(); i++) {
-		WriteS16(file, m_bank_list[i].frames.size());
-		WriteS16(file, 0);
-		WriteU32(file, frame_ofs);
+		writer.WriteS16(m_bank_list[i].frames.size());
+		writer.WriteS16(0);
+		writer.WriteU32(frame_ofs);
 		frame_ofs += m_bank_list[i].frames.size() * 12;
 	}
+	m_layout.EndSection(writer, ATB_SECTION_BANKS);
+	m_layout.BeginSection(writer, ATB_SECTION_FRAMES);
 	for (uint32_t i = 0; i < m_bank_list.size(); i++) {
 		for (uint32_t j = 0; j < m_bank_list[i].frames.size(); j++) {
 			int32_t pattern = SearchPattern(m_bank_list[i].frames[j].pattern_name);
 			if (pattern == -1) {
 				PrintError("Pattern %s doesn't exist.\n", m_bank_list[i].frames[j].pattern_name.c_str());
 			}
-			WriteS16(file, pattern);
-			WriteS16(file, m_bank_list[i].frames[j].delay);
-			WriteS16(file, 0);
-			WriteS16(file, 0);
-			WriteS16(file, 0);
-			WriteS16(file, 0);
+			writer.WriteS16(pattern);
+			writer.WriteS16(m_bank_list[i].frames[j].delay);
+			writer.WriteS16(0);
+			writer.WriteS16(0);
+			writer.WriteS16(0);
+			writer.WriteS16(0);
 		}
 	}
+	m_layout.EndSection(writer, ATB_SECTION_FRAMES);
 }
 
-void AtbFormat::WriteTextures(FILE *file)
+void AtbFormat::WriteTextures(ByteWriter &writer)
 {
-	uint8_t lookup_fmt[ATB_TEX_FORMAT_COUNT] = { TEX_FORMAT_RGBA8, TEX_FORMAT_RGB5A3, TEX_FORMAT_RGB5A3, TEX_FORMAT_CI8, TEX_FORMAT_CI4,
-			TEX_FORMAT_IA8, TEX_FORMAT_IA4, TEX_FORMAT_I8, TEX_FORMAT_I4, TEX_FORMAT_A8, TEX_FORMAT_CMPR };
-	uint32_t pal_data_ofs = m_texture_ofs + (20 * m_texture_list.size());
-	pal_data_ofs = (pal_data_ofs + 31) & 0xFFFFFFE0;
+	m_layout.BeginSection(writer, ATB_SECTION_TEXTURES);
 	for (uint32_t i = 0; i < m_texture_list.size(); i++) {
-		uint8_t bpp_table[ATB_TEX_FORMAT_COUNT] = { 32, 16, 16, 8, 4, 16, 8, 8, 4, 8, 4 };
-		uint32_t tex_data_ofs = pal_data_ofs;
-		if (m_texture_list[i].format == ATB_TEX_FORMAT_CI8 || m_texture_list[i].format == ATB_TEX_FORMAT_CI4) {
-			tex_data_ofs += 2 << bpp_table[m_texture_list[i].format];
-		}
-		WriteU8(file, bpp_table[m_texture_list[i].format]);
-		WriteU8(file, m_texture_list[i].format);
+		writer.WriteU8(GetTexBpp(GetEncodeFormat(m_texture_list[i].format)));
+		writer.WriteU8(m_texture_list[i].format);
 		if (m_texture_list[i].format == ATB_TEX_FORMAT_CI8 || m_texture_list[i].format == ATB_TEX_FORMAT_CI4) {
-			WriteS16(file, 1 << bpp_table[m_texture_list[i].format]);
+			writer.WriteS16(1 << GetTexBpp(GetEncodeFormat(m_texture_list[i].format)));
 		} else {
-			WriteS16(file, 0);
+			writer.WriteS16(0);
 		}
-		WriteS16(file, m_texture_list[i].w);
-		WriteS16(file, m_texture_list[i].h);
-		
-		uint8_t cur_lookup_fmt = lookup_fmt[m_texture_list[i].format];
-		uint32_t data_size = GetTexDataSize(cur_lookup_fmt, m_texture_list[i].w, m_texture_list[i].h);
-		WriteU32(file, data_size);
-		WriteU32(file, pal_data_ofs);
-		WriteU32(file, tex_data_ofs);
-		pal_data_ofs = tex_data_ofs + data_size;
+		writer.WriteS16(m_texture_list[i].w);
+		writer.WriteS16(m_texture_list[i].h);
+		writer.WriteU32(m_layout.GetSize(GetTexDataSection(i)));
+		writer.WriteU32(m_layout.GetOffset(GetPaletteSection(i)));
+		writer.WriteU32(m_layout.GetOffset(GetTexDataSection(i)));
 	}
-	AlignFile32(file);
-	for (uint32_t i = 0; i < m_texture_list.size(); i++) {
-		TextureWrite(file, lookup_fmt[m_texture_list[i].format], m_texture_list[i].w, m_texture_list[i].h, m_texture_list[i].image_data);
+	m_layout.EndSection(writer, ATB_SECTION_TEXTURES);
+	m_layout.BeginSection(writer, ATB_SECTION_TEXTURE_DATA);
+	m_layout.EndSection(writer, ATB_SECTION_TEXTURE_DATA);
+	std::vector<TextureSource> all_sources = GetTextureSources();
+	std::vector<TextureSource> sources;
+	for (uint32_t i = 0; i < all_sources.size(); i++) {
+		if (m_texture_owners[i] == i) {
+			sources.push_back(all_sources[i]);
+		}
+	}
+	TextureWriteAll(writer, sources, m_options);
+	m_layout.EndSection(writer, m_layout.GetSectionCount() - 1);
+}
+
+void AtbFormat::PlanLayout()
+{
+	m_layout.Clear();
+	m_layout.AddSection("header", 0x14);
+	m_layout.AddSection("patterns", m_pattern_list.size() * 16);
+	m_layout.AddSection("layers", GetLayerCount() * 32);
+	m_layout.AddSection("banks", m_bank_list.size() * 8);
+	m_layout.AddSection("frames", GetFrameCount() * 12);
+	m_layout.AddSection("textures", m_texture_list.size() * 20);
+	//Texture data is padded out to 32 bytes even when there are no textures
+	m_layout.AddSection("texture data", 0, 32, 0x88);
+	std::vector<TextureSource> sources = GetTextureSources();
+	m_texture_owners = FindDuplicateTextures(sources);
+	m_palette_sections.resize(sources.size());
+	m_data_sections.resize(sources.size());
+	PaletteGroupSections group_palettes = {};
+	uint32_t num_shared = 0;
+	uint32_t saved_size = 0;
+	for (uint32_t i = 0; i < sources.size(); i++) {
+		uint32_t pal_size = GetTexPalSize(sources[i].format);
+		uint32_t tex_size = GetTexDataSize(sources[i].format, sources[i].w, sources[i].h);
+		//Duplicate textures point at the sections of the first texture with the same payload
+		if (m_texture_owners[i] != i) {
+			m_palette_sections[i] = m_palette_sections[m_texture_owners[i]];
+			m_data_sections[i] = m_data_sections[m_texture_owners[i]];
+			num_shared++;
+			saved_size += pal_size + tex_size;
+			continue;
+		}
+		m_palette_sections[i] = PlanPaletteSection(m_layout, sources, i, m_texture_list[i].name + " palette", group_palettes);
+		m_data_sections[i] = m_layout.AddSection(m_texture_list[i].name, tex_size);
+	}
+	if (num_shared != 0) {
+		char message[128];
+		snprintf(message, sizeof(message), "Shared texture data of %u duplicate textures, saving %u bytes.", num_shared, saved_size);
+		m_messages.push_back(message);
+	}
+	if (group_palettes.num_shared != 0) {
+		char message[128];
+		snprintf(message, sizeof(message), "Shared %u palettes within palette groups, saving %u bytes.", group_palettes.num_shared, group_palettes.saved_size);
+		m_messages.push_back(message);
 	}
 }
 
-void AtbFormat::WriteData(FILE *file)
+void AtbFormat::WriteData(ByteWriter &writer)
 {
-	WriteS16(file, m_bank_list.size());
-	WriteS16(file, m_pattern_list.size());
-	WriteS16(file, m_texture_list.size());
-	WriteS16(file, 0x4100);
-	m_pattern_ofs = 0x14;
-	m_bank_ofs = m_pattern_ofs + GetPatternSize();
-	m_texture_ofs = m_bank_ofs + GetBankSize();
-	WriteU32(file, m_bank_ofs);
-	WriteU32(file, m_pattern_ofs);
-	WriteU32(file, m_texture_ofs);
-	WritePatterns(file);
-	WriteBanks(file);
-	WriteTextures(file);
+	m_layout.BeginSection(writer, ATB_SECTION_HEADER);
+	writer.WriteS16(m_bank_list.size());
+	writer.WriteS16(m_pattern_list.size());
+	writer.WriteS16(m_texture_list.size());
+	writer.WriteS16(0x4100);
+	writer.WriteU32(m_layout.GetOffset(ATB_SECTION_BANKS));
+	writer.WriteU32(m_layout.GetOffset(ATB_SECTION_PATTERNS));
+	writer.WriteU32(m_layout.GetOffset(ATB_SECTION_TEXTURES));
+	m_layout.EndSection(writer, ATB_SECTION_HEADER);
+	WritePatterns(writer);
+	WriteBanks(writer);
+	WriteTextures(writer);
 }
\ No newline at end of file
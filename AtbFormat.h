@@ -1,6 +1,8 @@
 #pragma once
 #include "AnimFormat.h"
 
+#include "ImageCache.h"
+#include "mpanimbuild.h"
 #include "tinyxml2.h"
 #include <string>
 #include <vector>
@@ -17,6 +19,18 @@
 #define ATB_TEX_FORMAT_A8 9
 #define ATB_TEX_FORMAT_CMPR 10
 #define ATB_TEX_FORMAT_COUNT 11
+//Replaced by the format FormatSelect picks once the image is loaded
+#define ATB_TEX_FORMAT_AUTO 0xFF
+
+#define ATB_SECTION_HEADER 0
+#define ATB_SECTION_PATTERNS 1
+#define ATB_SECTION_LAYERS 2
+#define ATB_SECTION_BANKS 3
+#define ATB_SECTION_FRAMES 4
+#define ATB_SECTION_TEXTURES 5
+#define ATB_SECTION_TEXTURE_DATA 6
+//Each texture then gets a palette section followed by a tile data section
+#define ATB_SECTION_COUNT 7
 
 struct AtbFrame {
 	std::string pattern_name;
@@ -53,36 +67,48 @@ struct AtbPattern {
 struct AtbTexture {
 	std::string name;
 	uint8_t format;
+	uint8_t cmpr_quality;
 	int w;
 	int h;
-	uint8_t *image_data;
+	std::shared_ptr<DecodedImage> image;
+	int32_t palette_group;
+	//Output of format="auto" selection, null for other textures
+	std::shared_ptr<EncodedTexture> encoded;
 };
 
 class AtbFormat : public AnimFormat
 {
 public:
-	AtbFormat(tinyxml2::XMLDocument *document, std::string base_path);
+	AtbFormat(tinyxml2::XMLDocument *document, std::string base_path, const EncodeOptions &options);
 	~AtbFormat();
 
 public:
-	virtual void WriteData(FILE *dst_file);
+	virtual void PlanLayout();
+	virtual void WriteData(ByteWriter &writer);
 
 private:
 	std::vector<AtbBank> m_bank_list;
 	std::vector<AtbPattern> m_pattern_list;
 	std::vector<AtbTexture> m_texture_list;
-	uint32_t m_pattern_ofs;
-	uint32_t m_bank_ofs;
-	uint32_t m_texture_ofs;
+	std::vector<PaletteGroup> m_palette_groups;
+	std::vector<uint32_t> m_texture_owners;
+	std::vector<uint32_t> m_palette_sections;
+	std::vector<uint32_t> m_data_sections;
 
 private:
-	uint32_t GetPatternSize();
-	uint32_t GetBankSize();
+	uint32_t GetLayerCount();
+	uint32_t GetFrameCount();
+	uint8_t GetEncodeFormat(uint8_t format);
+	//Inverse of GetEncodeFormat
+	uint8_t GetFileFormat(uint8_t tex_format);
+	uint32_t GetPaletteSection(uint32_t index);
+	uint32_t GetTexDataSection(uint32_t index);
+	std::vector<TextureSource> GetTextureSources();
 	int32_t SearchTexture(std::string name);
 	int32_t SearchPattern(std::string name);
-	void WritePatterns(FILE *file);
-	void WriteBanks(FILE *file);
-	void WriteTextures(FILE *file);
+	void WritePatterns(ByteWriter &writer);
+	void WriteBanks(ByteWriter &writer);
+	void WriteTextures(ByteWriter &writer);
 	void ParseBanks(tinyxml2::XMLNode *node);
 	void ParsePatterns(tinyxml2::XMLNode *node);
 	void ParseTextures(std::string base_path, tinyxml2::XMLNode *node);
@@ -0,0 +1,292 @@
+#define _CRT_SECURE_NO_WARNINGS
+#include <filesystem>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "BuildServer.h"
+#include "ImageCache.h"
+#include "mpanimbuild.h"
+#include "TextureCache.h"
+#include "ThreadPool.h"
+
+#ifdef _WIN32
+
+//Only a stale socket nothing listens on anymore may be replaced, never another file or a running server
+static bool RemoveStaleSocket(std::string socket_path, sockaddr_un &address)
+{
+	struct stat info;
+	if (lstat(socket_path.c_str(), &info) != 0) {
+		return errno == ENOENT;
+	}
+	if (!S_ISSOCK(info.st_mode)) {
+		fprintf(stderr, "%s exists and is not a socket.\n", socket_path.c_str());
+		return false;
+	}
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0) {
+		return false;
+	}
+	bool connected = connect(fd, (sockaddr *)&address, sizeof(address)) == 0;
+	int connect_error = errno;
+	close(fd);
+	if (connected) {
+		fprintf(stderr, "Build server already running on %s.\n", socket_path.c_str());
+		return false;
+	}
+	if (connect_error != ECONNREFUSED) {
+		fprintf(stderr, "Failed to check socket %s.\n", socket_path.c_str());
+		return false;
+	}
+	return unlink(socket_path.c_str()) == 0;
+}
+
+int RunBuildServer(std::string socket_path, std::vector<std::string> args)
+{
+	fprintf(stderr, "Build server mode is not supported on Windows.\n");
+	return 1;
+}
+
+int RunBuildClient(std::string socket_path, std::vector<std::string> args)
+{
+	fprintf(stderr, "Build server mode is not supported on Windows.\n");
+	return 1;
+}
+
+#else
+
+#include <errno.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+//Seconds a client may stall sending its request or reading its reply before the server drops it
+#define CLIENT_IO_TIMEOUT 10
+
+//Messages are a u32 string count followed by u32 length prefixed strings in native byte order
+//Requests are the client's working directory followed by its arguments
+//Replies are the exit status, standard output and standard error as strings
+
+static bool SendAll(int fd, const void *data, size_t size)
+{
+	const uint8_t *src = (const uint8_t *)data;
+	while (size > 0) {
+		ssize_t sent = send(fd, src, size, 0);
+		if (sent <= 0) {
+			return false;
+		}
+		src += sent;
+		size -= sent;
+	}
+	return true;
+}
+
+static bool RecvAll(int fd, void *data, size_t size)
+{
+	uint8_t *dst = (uint8_t *)data;
+	while (size > 0) {
+		ssize_t received = recv(fd, dst, size, 0);
+		if (received <= 0) {
+			return false;
+		}
+		dst += received;
+		size -= received;
+	}
+	return true;
+}
+
+static bool SendStrings(int fd, std::vector<std::string> &strings)
+{
+	uint32_t count = strings.size();
+	if (!SendAll(fd, &count, sizeof(count))) {
+		return false;
+	}
+	for (size_t i = 0; i < strings.size(); i++) {
+		uint32_t length = strings[i].length();
+		if (!SendAll(fd, &length, sizeof(length)) || !SendAll(fd, strings[i].data(), length)) {
+			return false;
+		}
+	}
+	return true;
+}
+
+static bool RecvStrings(int fd, std::vector<std::string> &strings)
+{
+	uint32_t count;
+	if (!RecvAll(fd, &count, sizeof(count)) || count > 65536) {
+		return false;
+	}
+	strings.resize(count);
+	for (uint32_t i = 0; i < count; i++) {
+		uint32_t length;
+		if (!RecvAll(fd, &length, sizeof(length)) || length > (64 * 1024 * 1024)) {
+			return false;
+		}
+		strings[i].resize(length);
+		if (length != 0 && !RecvAll(fd, &strings[i][0], length)) {
+			return false;
+		}
+	}
+	return true;
+}
+
+static bool MakeSocketAddress(std::string socket_path, sockaddr_un &address)
+{
+	memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+	if (socket_path.length() >= sizeof(address.sun_path)) {
+		fprintf(stderr, "Socket path %s is too long.\n", socket_path.c_str());
+		return false;
+	}
+	strcpy(address.sun_path, socket_path.c_str());
+	return true;
+}
+
+//Only a stale socket nothing listens on anymore may be replaced, never another file or a running server
+static bool RemoveStaleSocket(std::string socket_path, sockaddr_un &address)
+{
+	struct stat info;
+	if (lstat(socket_path.c_str(), &info) != 0) {
+		return errno == ENOENT;
+	}
+	if (!S_ISSOCK(info.st_mode)) {
+		fprintf(stderr, "%s exists and is not a socket.\n", socket_path.c_str());
+		return false;
+	}
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0) {
+		return false;
+	}
+	bool connected = connect(fd, (sockaddr *)&address, sizeof(address)) == 0;
+	int connect_error = errno;
+	close(fd);
+	if (connected) {
+		fprintf(stderr, "Build server already running on %s.\n", socket_path.c_str());
+		return false;
+	}
+	if (connect_error != ECONNREFUSED) {
+		fprintf(stderr, "Failed to check socket %s.\n", socket_path.c_str());
+		return false;
+	}
+	return unlink(socket_path.c_str()) == 0;
+}
+
+int RunBuildServer(std::string socket_path, std::vector<std::string> args)
+{
+	for (size_t i = 0; i < args.size(); i++) {
+		if (args[i] == "-j" && i + 1 < args.size()) {
+			ThreadPool::SetDefaultThreadCount(atoi(args[++i].c_str()));
+		} else {
+			fprintf(stderr, "Unknown build server option %s.\n", args[i].c_str());
+			return 1;
+		}
+	}
+	sockaddr_un address;
+	if (!MakeSocketAddress(socket_path, address)) {
+		return 1;
+	}
+	int server_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (server_fd < 0) {
+		fprintf(stderr, "Failed to create socket %s.\n", socket_path.c_str());
+		return 1;
+	}
+	//Clients that disconnect early shouldn't kill the server
+	signal(SIGPIPE, SIG_IGN);
+	if (!RemoveStaleSocket(socket_path, address)) {
+		close(server_fd);
+		return 1;
+	}
+	struct stat bound_info;
+	if (bind(server_fd, (sockaddr *)&address, sizeof(address)) != 0 || listen(server_fd, 16) != 0
+		|| lstat(socket_path.c_str(), &bound_info) != 0) {
+		fprintf(stderr, "Failed to listen on socket %s.\n", socket_path.c_str());
+		close(server_fd);
+		return 1;
+	}
+	ImageCache::SetEnabled(true);
+	TextureCache::SetMemoryCacheEnabled(true);
+	ThreadPool::Get();
+	printf("Build server listening on %s.\n", socket_path.c_str());
+	fflush(stdout);
+	bool running = true;
+	while (running) {
+		int client_fd = accept(server_fd, NULL, NULL);
+		if (client_fd < 0) {
+			continue;
+		}
+		//A stalled client would otherwise block every build after it
+		timeval timeout = { CLIENT_IO_TIMEOUT, 0 };
+		setsockopt(client_fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+		setsockopt(client_fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+		std::vector<std::string> request;
+		if (!RecvStrings(client_fd, request) || request.empty()) {
+			close(client_fd);
+			continue;
+		}
+		std::string work_dir = request[0];
+		std::vector<std::string> command(request.begin() + 1, request.end());
+		BuildLog log(true);
+		int status;
+		if (command.size() == 1 && command[0] == "-shutdown") {
+			log.Print("Build server shutting down.\n");
+			running = false;
+			status = 0;
+		} else {
+			//Failures outside the build's own error handling fail the request instead of the server
+			try {
+				status = RunCommand(command, work_dir, log);
+			} catch (std::exception &error) {
+				log.Error("Build failed: %s\n", error.what());
+				status = 1;
+			}
+		}
+		std::vector<std::string> reply;
+		reply.push_back(std::to_string(status));
+		reply.push_back(log.GetOutput());
+		reply.push_back(log.GetErrors());
+		SendStrings(client_fd, reply);
+		close(client_fd);
+	}
+	close(server_fd);
+	//Another server may have replaced the socket since, only remove the one bound here
+	struct stat info;
+	if (lstat(socket_path.c_str(), &info) == 0 && info.st_dev == bound_info.st_dev && info.st_ino == bound_info.st_ino) {
+		unlink(socket_path.c_str());
+	}
+	return 0;
+}
+
+int RunBuildClient(std::string socket_path, std::vector<std::string> args)
+{
+	sockaddr_un address;
+	if (!MakeSocketAddress(socket_path, address)) {
+		return 1;
+	}
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0 || connect(fd, (sockaddr *)&address, sizeof(address)) != 0) {
+		fprintf(stderr, "Failed to connect to build server at %s.\n", socket_path.c_str());
+		if (fd >= 0) {
+			close(fd);
+		}
+		return 1;
+	}
+	std::error_code error;
+	std::vector<std::string> request;
+	request.push_back(std::filesystem::current_path(error).string());
+	request.insert(request.end(), args.begin(), args.end());
+	std::vector<std::string> reply;
+	if (!SendStrings(fd, request) || !RecvStrings(fd, reply) || reply.size() != 3) {
+		fprintf(stderr, "Lost connection to build server at %s.\n", socket_path.c_str());
+		close(fd);
+		return 1;
+	}
+	close(fd);
+	fputs(reply[1].c_str(), stdout);
+	fputs(reply[2].c_str(), stderr);
+	return atoi(reply[0].c_str());
+}
+
+#endif
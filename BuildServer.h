@@ -0,0 +1,9 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+//Long-lived build server listening on a Unix domain socket, keeps decoded images and encoded textures warm between requests
+int RunBuildServer(std::string socket_path, std::vector<std::string> args);
+//Sends a normal mpanimbuild command line to a build server and returns its exit status
+int RunBuildClient(std::string socket_path, std::vector<std::string> args);
@@ -0,0 +1,109 @@
+#include "ByteWriter.h"
+#include "mpanimbuild.h"
+
+ByteWriter::ByteWriter()
+{
+	m_data = nullptr;
+	m_position = 0;
+	m_capacity = 0;
+	m_fixed = false;
+}
+
+ByteWriter::ByteWriter(uint8_t *data, size_t size)
+{
+	m_data = data;
+	m_position = 0;
+	m_capacity = size;
+	m_fixed = true;
+}
+
+void ByteWriter::Reserve(size_t size)
+{
+	if (!m_fixed && size > m_capacity) {
+		m_buffer.resize(size);
+		m_data = m_buffer.data();
+		m_capacity = size;
+	}
+}
+
+size_t ByteWriter::GetPosition()
+{
+	return m_position;
+}
+
+uint8_t *ByteWriter::GetData()
+{
+	return m_data;
+}
+
+void ByteWriter::Align(size_t alignment, uint8_t fill)
+{
+	Pad((alignment - (m_position % alignment)) % alignment, fill);
+}
+
+void ByteWriter::Pad(size_t size, uint8_t fill)
+{
+	if (size != 0) {
+		memset(Grow(size), fill, size);
+	}
+}
+
+uint8_t *ByteWriter::Allocate(size_t size)
+{
+	if (size == 0) {
+		return m_data + m_position;
+	}
+	return Grow(size);
+}
+
+void ByteWriter::WriteBytes(const void *data, size_t size)
+{
+	if (size != 0) {
+		memcpy(Grow(size), data, size);
+	}
+}
+
+void ByteWriter::WriteS16Array(const int16_t *values, size_t count)
+{
+	uint8_t *dst = Grow(count * 2);
+	for (size_t i = 0; i < count; i++) {
+		StoreU16(&dst[i * 2], values[i]);
+	}
+}
+
+void ByteWriter::WriteU32Array(const uint32_t *values, size_t count)
+{
+	uint8_t *dst = Grow(count * 4);
+	for (size_t i = 0; i < count; i++) {
+		StoreU32(&dst[i * 4], values[i]);
+	}
+}
+
+void ByteWriter::WriteFloatArray(const float *values, size_t count)
+{
+	uint8_t *dst = Grow(count * 4);
+	for (size_t i = 0; i < count; i++) {
+		uint32_t bits;
+		memcpy(&bits, &values[i], 4);
+		StoreU32(&dst[i * 4], bits);
+	}
+}
+
+bool ByteWriter::Flush(FILE *file)
+{
+	return fwrite(m_data, 1, m_position, file) == m_position;
+}
+
+void ByteWriter::Expand(size_t size)
+{
+	if (m_fixed) {
+		PrintError("Output overflowed its planned size of %u bytes.\n", (uint32_t)m_capacity);
+	}
+	size_t capacity = m_capacity * 2;
+	if (capacity < size) {
+		capacity = size;
+	}
+	m_buffer.resize(capacity);
+	m_data = m_buffer.data();
+	m_capacity = capacity;
+}
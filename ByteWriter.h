@@ -0,0 +1,100 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+
+//Builds a big-endian file in memory so it can be written out with a single fwrite
+class ByteWriter
+{
+public:
+	ByteWriter();
+	//Writes into a caller-owned buffer of a fixed size such as a mapped file
+	ByteWriter(uint8_t *data, size_t size);
+
+public:
+	void Reserve(size_t size);
+	size_t GetPosition();
+	uint8_t *GetData();
+	void Align(size_t alignment, uint8_t fill);
+	void Pad(size_t size, uint8_t fill);
+	//Returns space for size bytes to be filled in later, possibly from other threads
+	uint8_t *Allocate(size_t size);
+	void WriteBytes(const void *data, size_t size);
+	void WriteS16Array(const int16_t *values, size_t count);
+	void WriteU32Array(const uint32_t *values, size_t count);
+	void WriteFloatArray(const float *values, size_t count);
+	bool Flush(FILE *file);
+
+	void WriteU8(uint8_t value)
+	{
+		Grow(1)[0] = value;
+	}
+
+	void WriteS8(int8_t value)
+	{
+		Grow(1)[0] = value;
+	}
+
+	void WriteU16(uint16_t value)
+	{
+		StoreU16(Grow(2), value);
+	}
+
+	void WriteS16(int16_t value)
+	{
+		StoreU16(Grow(2), value);
+	}
+
+	void WriteU32(uint32_t value)
+	{
+		StoreU32(Grow(4), value);
+	}
+
+	void WriteS32(int32_t value)
+	{
+		StoreU32(Grow(4), value);
+	}
+
+	void WriteFloat(float value)
+	{
+		uint32_t bits;
+		memcpy(&bits, &value, 4);
+		StoreU32(Grow(4), bits);
+	}
+
+private:
+	std::vector<uint8_t> m_buffer;
+	uint8_t *m_data;
+	size_t m_position;
+	size_t m_capacity;
+	bool m_fixed;
+
+private:
+	void Expand(size_t size);
+
+	uint8_t *Grow(size_t size)
+	{
+		if (m_position + size > m_capacity) {
+			Expand(m_position + size);
+		}
+		uint8_t *dst = &m_data[m_position];
+		m_position += size;
+		return dst;
+	}
+
+	static void StoreU16(uint8_t *dst, uint16_t value)
+	{
+		dst[0] = value >> 8;
+		dst[1] = value & 0xFF;
+	}
+
+	static void StoreU32(uint8_t *dst, uint32_t value)
+	{
+		dst[0] = value >> 24;
+		dst[1] = (value >> 16) & 0xFF;
+		dst[2] = (value >> 8) & 0xFF;
+		dst[3] = value & 0xFF;
+	}
+};
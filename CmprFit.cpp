@@ -0,0 +1,544 @@
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include "mpanimbuild.h"
+#include "tex_convert.h"
+#include "CmprFit.h"
+
+//Pixels below this alpha use the transparent palette entry, the same threshold the fast mode picks 3 color blocks with
+#define CMPR_ALPHA_THRESHOLD 128
+#define CMPR_AXIS_ITERATIONS 8
+#define CMPR_CLUSTER_ITERATIONS 2
+//Most moves of the ClusterFit search, each tries up to 26 neighbouring splits
+#define CMPR_CLUSTER_SEARCH_STEPS 8
+#define CMPR_REFINE_ITERATIONS 4
+
+//Opaque pixels of a block in the order they appear
+struct CmprFitBlock {
+	float colors[16][3];
+	int32_t count;
+	bool alpha;
+	uint32_t transparent_mask;
+};
+
+static uint8_t Expand5(uint32_t value)
+{
+	return (value << 3) | (value >> 2);
+}
+
+static uint8_t Expand6(uint32_t value)
+{
+	return (value << 2) | (value >> 4);
+}
+
+static uint16_t QuantizeColor(const float *color)
+{
+	int32_t rgb[3];
+	for (int32_t i = 0; i < 3; i++) {
+		float value = color[i] + 0.5f;
+		if (value < 0.0f) {
+			value = 0.0f;
+		}
+		if (value > 255.0f) {
+			value = 255.0f;
+		}
+		rgb[i] = (int32_t)value;
+	}
+	return (color_8_to_5[rgb[0]] << 11) | (color_8_to_6[rgb[1]] << 5) | color_8_to_5[rgb[2]];
+}
+
+static void ExpandColor(uint16_t color, float *dst)
+{
+	dst[0] = Expand5(color >> 11);
+	dst[1] = Expand6((color >> 5) & 0x3F);
+	dst[2] = Expand5(color & 0x1F);
+}
+
+void DecodePaletteCMPR(uint16_t color0, uint16_t color1, uint8_t *palette)
+{
+	palette[0] = Expand5(color0 >> 11);
+	palette[1] = Expand6((color0 >> 5) & 0x3F);
+	palette[2] = Expand5(color0 & 0x1F);
+	palette[3] = 255;
+	palette[4] = Expand5(color1 >> 11);
+	palette[5] = Expand6((color1 >> 5) & 0x3F);
+	palette[6] = Expand5(color1 & 0x1F);
+	palette[7] = 255;
+	if (color0 > color1) {
+		for (int32_t i = 0; i < 3; i++) {
+			palette[8 + i] = ((palette[i] * 5) + (palette[4 + i] * 3)) / 8;
+			palette[12 + i] = ((palette[i] * 3) + (palette[4 + i] * 5)) / 8;
+		}
+		palette[11] = 255;
+		palette[15] = 255;
+	} else {
+		for (int32_t i = 0; i < 3; i++) {
+			palette[8 + i] = (palette[i] + palette[4 + i]) / 2;
+		}
+		palette[11] = 255;
+		memset(&palette[12], 0, 4);
+	}
+}
+
+//Endpoint pairs whose blend is closest to each 8-bit value, for the 5/8 entry of 4 color blocks and the middle entry of 3 color blocks
+struct CmprSingleColorTables {
+	uint8_t blend5[256][2];
+	uint8_t blend6[256][2];
+	uint8_t half5[256][2];
+	uint8_t half6[256][2];
+};
+
+static void BuildSingleColorTable(uint8_t (*table)[2], int32_t bits, bool half)
+{
+	int32_t max = (1 << bits) - 1;
+	for (int32_t value = 0; value < 256; value++) {
+		int32_t best_error = 256;
+		for (int32_t i = 0; i <= max; i++) {
+			for (int32_t j = 0; j <= max; j++) {
+				int32_t color0 = (bits == 5) ? Expand5(i) : Expand6(i);
+				int32_t color1 = (bits == 5) ? Expand5(j) : Expand6(j);
+				int32_t blend = half ? ((color0 + color1) / 2) : (((color0 * 5) + (color1 * 3)) / 8);
+				int32_t error = abs(blend - value);
+				if (error < best_error) {
+					best_error = error;
+					table[value][0] = i;
+					table[value][1] = j;
+				}
+			}
+		}
+	}
+}
+
+static const CmprSingleColorTables &GetSingleColorTables()
+{
+	static const CmprSingleColorTables tables = []() {
+		CmprSingleColorTables tables;
+		BuildSingleColorTable(tables.blend5, 5, false);
+		BuildSingleColorTable(tables.blend6, 6, false);
+		BuildSingleColorTable(tables.half5, 5, true);
+		BuildSingleColorTable(tables.half6, 6, true);
+		return tables;
+	}();
+	return tables;
+}
+
+static void WriteBlock(uint8_t *dst, uint16_t color0, uint16_t color1, int32_t *indices)
+{
+	dst[0] = color0 >> 8;
+	dst[1] = color0 & 0xFF;
+	dst[2] = color1 >> 8;
+	dst[3] = color1 & 0xFF;
+	for (int32_t i = 0; i < 4; i++) {
+		dst[4 + i] = indices[i * 4] << 6 | indices[(i * 4) + 1] << 4 | indices[(i * 4) + 2] << 2 | indices[(i * 4) + 3];
+	}
+}
+
+void EncodeSingleColorCMPR(uint8_t *dst, uint8_t *rgb, bool alpha, uint32_t transparent_mask)
+{
+	const CmprSingleColorTables &tables = GetSingleColorTables();
+	const uint8_t (*table5)[2] = alpha ? tables.half5 : tables.blend5;
+	const uint8_t (*table6)[2] = alpha ? tables.half6 : tables.blend6;
+	uint16_t color0 = (table5[rgb[0]][0] << 11) | (table6[rgb[1]][0] << 5) | table5[rgb[2]][0];
+	uint16_t color1 = (table5[rgb[0]][1] << 11) | (table6[rgb[1]][1] << 5) | table5[rgb[2]][1];
+	int32_t index = 2;
+	if (alpha) {
+		if (color0 > color1) {
+			std::swap(color0, color1);
+		}
+	} else if (color0 < color1) {
+		//The 3/8 entry of the swapped pair is the same blend
+		std::swap(color0, color1);
+		index = 3;
+	}
+	int32_t indices[16];
+	for (int32_t i = 0; i < 16; i++) {
+		indices[i] = (transparent_mask & (1 << i)) ? 3 : index;
+	}
+	WriteBlock(dst, color0, color1, indices);
+}
+
+//Weight of color0 in each palette entry, the rest comes from color1
+static const float cmpr_weights_4[4] = { 1.0f, 0.0f, 5.0f / 8.0f, 3.0f / 8.0f };
+static const float cmpr_weights_3[4] = { 1.0f, 0.0f, 0.5f, 0.0f };
+
+static void OrderEndpoints(uint16_t *color0, uint16_t *color1, bool alpha)
+{
+	//4 color blocks need color0 > color1 and 3 color blocks the opposite
+	if ((alpha && *color0 > *color1) || (!alpha && *color0 < *color1)) {
+		std::swap(*color0, *color1);
+	}
+}
+
+//Squared error of the opaque pixels with the given endpoints, the chosen indices are written to indices
+static int32_t EvaluateEndpoints(const CmprFitBlock &fit, uint8_t *block, uint16_t color0, uint16_t color1, const CmprKernels &kernels, int32_t *indices)
+{
+	uint8_t palette[16];
+	DecodePaletteCMPR(color0, color1, palette);
+	kernels.select_indices(palette, (color0 > color1) ? 4 : 3, block, indices);
+	int32_t error = 0;
+	for (int32_t i = 0; i < 16; i++) {
+		if (fit.transparent_mask & (1 << i)) {
+			indices[i] = 3;
+			continue;
+		}
+		for (int32_t j = 0; j < 3; j++) {
+			int32_t diff = (int32_t)palette[(indices[i] * 4) + j] - (int32_t)block[(i * 4) + j];
+			error += diff * diff;
+		}
+	}
+	return error;
+}
+
+//Principal axis of the opaque pixels by power iteration on their covariance, zero for a single color
+static void GetPrincipalAxis(const CmprFitBlock &fit, float *mean, float *axis)
+{
+	float covariance[3][3] = {};
+	mean[0] = mean[1] = mean[2] = 0.0f;
+	for (int32_t i = 0; i < fit.count; i++) {
+		for (int32_t j = 0; j < 3; j++) {
+			mean[j] += fit.colors[i][j] / fit.count;
+		}
+	}
+	for (int32_t i = 0; i < fit.count; i++) {
+		for (int32_t j = 0; j < 3; j++) {
+			for (int32_t k = 0; k < 3; k++) {
+				covariance[j][k] += (fit.colors[i][j] - mean[j]) * (fit.colors[i][k] - mean[k]);
+			}
+		}
+	}
+	//Start from the row of the channel with the most variance
+	int32_t start = 0;
+	for (int32_t i = 1; i < 3; i++) {
+		if (covariance[i][i] > covariance[start][start]) {
+			start = i;
+		}
+	}
+	memcpy(axis, covariance[start], sizeof(float) * 3);
+	for (int32_t i = 0; i < CMPR_AXIS_ITERATIONS; i++) {
+		float length = sqrtf((axis[0] * axis[0]) + (axis[1] * axis[1]) + (axis[2] * axis[2]));
+		if (length < 1e-6f) {
+			axis[0] = axis[1] = axis[2] = 0.0f;
+			return;
+		}
+		float next[3];
+		for (int32_t j = 0; j < 3; j++) {
+			next[j] = ((covariance[j][0] * axis[0]) + (covariance[j][1] * axis[1]) + (covariance[j][2] * axis[2])) / length;
+		}
+		memcpy(axis, next, sizeof(float) * 3);
+	}
+	float length = sqrtf((axis[0] * axis[0]) + (axis[1] * axis[1]) + (axis[2] * axis[2]));
+	for (int32_t i = 0; i < 3; i++) {
+		axis[i] = (length < 1e-6f) ? 0.0f : axis[i] / length;
+	}
+}
+
+//Endpoints at the extremes of the pixels projected onto the axis
+static void RangeFit(const CmprFitBlock &fit, const float *mean, const float *axis, float *start, float *end)
+{
+	float min_proj = 0.0f;
+	float max_proj = 0.0f;
+	for (int32_t i = 0; i < fit.count; i++) {
+		float proj = 0.0f;
+		for (int32_t j = 0; j < 3; j++) {
+			proj += (fit.colors[i][j] - mean[j]) * axis[j];
+		}
+		min_proj = std::min(min_proj, proj);
+		max_proj = std::max(max_proj, proj);
+	}
+	for (int32_t i = 0; i < 3; i++) {
+		start[i] = mean[i] + (axis[i] * max_proj);
+		end[i] = mean[i] + (axis[i] * min_proj);
+	}
+}
+
+//Least squares endpoints for pixels with the given color0 weights, false if they are all on one endpoint
+static bool SolveEndpoints(const CmprFitBlock &fit, const float *weights, float *start, float *end)
+{
+	float alpha2 = 0.0f;
+	float beta2 = 0.0f;
+	float alphabeta = 0.0f;
+	float alphax[3] = {};
+	float betax[3] = {};
+	for (int32_t i = 0; i < fit.count; i++) {
+		float alpha = weights[i];
+		float beta = 1.0f - alpha;
+		alpha2 += alpha * alpha;
+		beta2 += beta * beta;
+		alphabeta += alpha * beta;
+		for (int32_t j = 0; j < 3; j++) {
+			alphax[j] += alpha * fit.colors[i][j];
+			betax[j] += beta * fit.colors[i][j];
+		}
+	}
+	float det = (alpha2 * beta2) - (alphabeta * alphabeta);
+	if (fabsf(det) < 1e-6f) {
+		return false;
+	}
+	for (int32_t i = 0; i < 3; i++) {
+		start[i] = ((alphax[i] * beta2) - (betax[i] * alphabeta)) / det;
+		end[i] = ((betax[i] * alpha2) - (alphax[i] * alphabeta)) / det;
+	}
+	return true;
+}
+
+//Snaps endpoints to the RGB565 grid and returns the squared error of a weighted assignment with them
+static float ClusterError(const float *sum_x2, const float *alphax, const float *betax, float alpha2, float beta2, float alphabeta, float *start, float *end)
+{
+	ExpandColor(QuantizeColor(start), start);
+	ExpandColor(QuantizeColor(end), end);
+	float error = 0.0f;
+	for (int32_t i = 0; i < 3; i++) {
+		error += sum_x2[i] + (start[i] * start[i] * alpha2) + (end[i] * end[i] * beta2) + (2.0f * start[i] * end[i] * alphabeta)
+			- (2.0f * start[i] * alphax[i]) - (2.0f * end[i] * betax[i]);
+	}
+	return error;
+}
+
+static void SortAlongAxis(const CmprFitBlock &fit, const float *axis, int32_t *order)
+{
+	float proj[16];
+	for (int32_t i = 0; i < fit.count; i++) {
+		order[i] = i;
+		proj[i] = (fit.colors[i][0] * axis[0]) + (fit.colors[i][1] * axis[1]) + (fit.colors[i][2] * axis[2]);
+	}
+	std::stable_sort(order, order + fit.count, [&proj](int32_t a, int32_t b) {
+		return proj[a] > proj[b];
+	});
+}
+
+//Running sums of the pixels sorted along an axis, shared by every split ClusterFit tries
+struct CmprClusterSums {
+	//prefix[i] is the sum of the first i sorted pixels
+	float prefix[17][3];
+	float sum_x2[3];
+	int32_t count;
+	//Weights of color0 in the two interpolated entries, the 5/8 and 3/8 ones in 4 color blocks
+	float w1;
+	float w2;
+	//Run boundaries only go where the sorted color changes, stops[i] is the position of the ith such place
+	int32_t stops[17];
+	int32_t num_stops;
+};
+
+//Least squares endpoints when the sorted pixels before stop split[0] use color0, the ones before split[1] and split[2] the
+//interpolated entries and the rest color1
+//Returns their error after snapping them to RGB565
+static float ClusterSplitError(const CmprClusterSums &sums, const int32_t *split, float *start, float *end)
+{
+	int32_t n = sums.count;
+	int32_t a = sums.stops[split[0]];
+	int32_t b = sums.stops[split[1]];
+	int32_t c = sums.stops[split[2]];
+	float w1 = sums.w1;
+	float w2 = sums.w2;
+	float count1 = (float)(b - a);
+	float count2 = (float)(c - b);
+	float alpha2 = a + (count1 * w1 * w1) + (count2 * w2 * w2);
+	float beta2 = (n - c) + (count1 * (1.0f - w1) * (1.0f - w1)) + (count2 * (1.0f - w2) * (1.0f - w2));
+	float alphabeta = (count1 * w1 * (1.0f - w1)) + (count2 * w2 * (1.0f - w2));
+	float det = (alpha2 * beta2) - (alphabeta * alphabeta);
+	if (fabsf(det) < 1e-6f) {
+		return INFINITY;
+	}
+	float inv_det = 1.0f / det;
+	float alphax[3], betax[3];
+	for (int32_t i = 0; i < 3; i++) {
+		float run0 = sums.prefix[a][i];
+		float run1 = sums.prefix[b][i] - sums.prefix[a][i];
+		float run2 = sums.prefix[c][i] - sums.prefix[b][i];
+		float run3 = sums.prefix[n][i] - sums.prefix[c][i];
+		alphax[i] = run0 + (run1 * w1) + (run2 * w2);
+		betax[i] = run3 + (run1 * (1.0f - w1)) + (run2 * (1.0f - w2));
+		start[i] = ((alphax[i] * beta2) - (betax[i] * alphabeta)) * inv_det;
+		end[i] = ((betax[i] * alpha2) - (alphax[i] * alphabeta)) * inv_det;
+	}
+	return ClusterError(sums.sum_x2, alphax, betax, alpha2, beta2, alphabeta, start, end);
+}
+
+//Moves the run boundaries in split one step at a time while that lowers the error and returns the lowest error found
+static float ClimbClusterSplits(const CmprClusterSums &sums, bool alpha, int32_t *split, float *start, float *end)
+{
+	float best_error = ClusterSplitError(sums, split, start, end);
+	for (int32_t step = 0; step < CMPR_CLUSTER_SEARCH_STEPS; step++) {
+		int32_t best_split[3] = { split[0], split[1], split[2] };
+		for (int32_t da = -1; da <= 1; da++) {
+			for (int32_t db = -1; db <= 1; db++) {
+				//3 color blocks only have one interpolated entry so the second run stays empty
+				for (int32_t dc = alpha ? db : -1; dc <= (alpha ? db : 1); dc++) {
+					int32_t new_split[3] = { split[0] + da, split[1] + db, split[2] + dc };
+					if ((da == 0 && db == 0 && dc == 0) || new_split[0] < 0 || new_split[1] < new_split[0] || new_split[2] < new_split[1]
+						|| new_split[2] >= sums.num_stops) {
+						continue;
+					}
+					float cur_start[3], cur_end[3];
+					float error = ClusterSplitError(sums, new_split, cur_start, cur_end);
+					if (error < best_error) {
+						best_error = error;
+						memcpy(best_split, new_split, sizeof(best_split));
+						memcpy(start, cur_start, sizeof(float) * 3);
+						memcpy(end, cur_end, sizeof(float) * 3);
+					}
+				}
+			}
+		}
+		if (memcmp(best_split, split, sizeof(best_split)) == 0) {
+			break;
+		}
+		memcpy(split, best_split, sizeof(best_split));
+	}
+	return best_error;
+}
+
+//Splits the sorted pixels into runs of palette entries and returns the least squares endpoints of the best split found
+//Trying every split is O(n^3) per block, so the search instead starts from the split start and end give the pixels
+//and moves one boundary at a time while that lowers the error
+static float ClusterFit(const CmprFitBlock &fit, const int32_t *order, float *start, float *end)
+{
+	CmprClusterSums sums = {};
+	sums.count = fit.count;
+	sums.w1 = fit.alpha ? 0.5f : (5.0f / 8.0f);
+	sums.w2 = fit.alpha ? 0.5f : (3.0f / 8.0f);
+	for (int32_t i = 0; i < fit.count; i++) {
+		for (int32_t j = 0; j < 3; j++) {
+			float value = fit.colors[order[i]][j];
+			sums.prefix[i + 1][j] = sums.prefix[i][j] + value;
+			sums.sum_x2[j] += value * value;
+		}
+		if (i == 0 || memcmp(fit.colors[order[i]], fit.colors[order[i - 1]], sizeof(fit.colors[0])) != 0) {
+			sums.stops[sums.num_stops++] = i;
+		}
+	}
+	sums.stops[sums.num_stops++] = fit.count;
+	//Each pixel starts on the entry nearest its position between the endpoints, the order already runs from start to end
+	float line[3];
+	float length2 = 0.0f;
+	for (int32_t i = 0; i < 3; i++) {
+		line[i] = start[i] - end[i];
+		length2 += line[i] * line[i];
+	}
+	float bound_a = fit.alpha ? 0.75f : (13.0f / 16.0f);
+	float bound_b = fit.alpha ? 0.25f : 0.5f;
+	float bound_c = 3.0f / 16.0f;
+	int32_t split[3] = { 0, 0, 0 };
+	for (int32_t i = 1; i < sums.num_stops && length2 > 0.0f; i++) {
+		float t = 0.0f;
+		for (int32_t j = 0; j < 3; j++) {
+			t += (fit.colors[order[sums.stops[i - 1]]][j] - end[j]) * line[j];
+		}
+		t /= length2;
+		split[0] += t > bound_a;
+		split[1] += t > bound_b;
+		split[2] += t > bound_c;
+	}
+	if (fit.alpha) {
+		split[2] = split[1];
+	}
+	float cur_start[3], cur_end[3];
+	float error = ClimbClusterSplits(sums, fit.alpha, split, cur_start, cur_end);
+	if (error != INFINITY) {
+		memcpy(start, cur_start, sizeof(float) * 3);
+		memcpy(end, cur_end, sizeof(float) * 3);
+	}
+	return error;
+}
+
+void FitBlockCMPR(uint8_t *dst, uint8_t *block, uint8_t quality, const CmprKernels &kernels)
+{
+	CmprFitBlock fit;
+	fit.count = 0;
+	fit.alpha = false;
+	fit.transparent_mask = 0;
+	int32_t first_opaque = -1;
+	bool uniform = true;
+	for (int32_t i = 0; i < 16; i++) {
+		if (block[(i * 4) + 3] < CMPR_ALPHA_THRESHOLD) {
+			fit.alpha = true;
+			fit.transparent_mask |= 1 << i;
+		} else {
+			if (first_opaque == -1) {
+				first_opaque = i;
+			} else if (memcmp(&block[i * 4], &block[first_opaque * 4], 3) != 0) {
+				uniform = false;
+			}
+			for (int32_t j = 0; j < 3; j++) {
+				fit.colors[fit.count][j] = block[(i * 4) + j];
+			}
+			fit.count++;
+		}
+	}
+	int32_t indices[16];
+	if (fit.count == 0) {
+		for (int32_t i = 0; i < 16; i++) {
+			indices[i] = 3;
+		}
+		WriteBlock(dst, 0, 0, indices);
+		return;
+	}
+	if (uniform) {
+		EncodeSingleColorCMPR(dst, &block[first_opaque * 4], fit.alpha, fit.transparent_mask);
+		return;
+	}
+	float mean[3], axis[3], start[3], end[3];
+	GetPrincipalAxis(fit, mean, axis);
+	RangeFit(fit, mean, axis, start, end);
+	if (quality == CMPR_QUALITY_CLUSTER && (axis[0] != 0.0f || axis[1] != 0.0f || axis[2] != 0.0f)) {
+		//Each pass orders the pixels along the line through the last endpoints until the order stops changing
+		float best_error = INFINITY;
+		int32_t order[16];
+		int32_t last_order[16];
+		for (int32_t i = 0; i < CMPR_CLUSTER_ITERATIONS; i++) {
+			SortAlongAxis(fit, axis, order);
+			if (i > 0 && memcmp(order, last_order, sizeof(int32_t) * fit.count) == 0) {
+				break;
+			}
+			memcpy(last_order, order, sizeof(int32_t) * fit.count);
+			float cur_start[3], cur_end[3];
+			memcpy(cur_start, start, sizeof(float) * 3);
+			memcpy(cur_end, end, sizeof(float) * 3);
+			float error = ClusterFit(fit, order, cur_start, cur_end);
+			if (error >= best_error) {
+				break;
+			}
+			best_error = error;
+			memcpy(start, cur_start, sizeof(float) * 3);
+			memcpy(end, cur_end, sizeof(float) * 3);
+			for (int32_t j = 0; j < 3; j++) {
+				axis[j] = start[j] - end[j];
+			}
+		}
+	}
+	uint16_t color0 = QuantizeColor(start);
+	uint16_t color1 = QuantizeColor(end);
+	OrderEndpoints(&color0, &color1, fit.alpha);
+	int32_t best_error = EvaluateEndpoints(fit, block, color0, color1, kernels, indices);
+	if (quality == CMPR_QUALITY_CLUSTER) {
+		//Refit the endpoints to the indices the quantized palette actually picked
+		for (int32_t i = 0; i < CMPR_REFINE_ITERATIONS && best_error > 0; i++) {
+			const float *entry_weights = (color0 > color1) ? cmpr_weights_4 : cmpr_weights_3;
+			float weights[16];
+			int32_t count = 0;
+			for (int32_t j = 0; j < 16; j++) {
+				if (!(fit.transparent_mask & (1 << j))) {
+					weights[count++] = entry_weights[indices[j]];
+				}
+			}
+			if (!SolveEndpoints(fit, weights, start, end)) {
+				break;
+			}
+			uint16_t new_color0 = QuantizeColor(start);
+			uint16_t new_color1 = QuantizeColor(end);
+			OrderEndpoints(&new_color0, &new_color1, fit.alpha);
+			int32_t new_indices[16];
+			int32_t error = EvaluateEndpoints(fit, block, new_color0, new_color1, kernels, new_indices);
+			if (error >= best_error) {
+				break;
+			}
+			best_error = error;
+			color0 = new_color0;
+			color1 = new_color1;
+			memcpy(indices, new_indices, sizeof(indices));
+		}
+	}
+	WriteBlock(dst, color0, color1, indices);
+}
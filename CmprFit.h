@@ -0,0 +1,13 @@
+#pragma once
+
+#include <stdint.h>
+#include "TexConvertSimd.h"
+
+//Palette the hardware builds from two RGB565 endpoints as 4 RGBA8 entries
+//Blocks with color0 <= color1 have 3 colors and a transparent last entry
+void DecodePaletteCMPR(uint16_t color0, uint16_t color1, uint8_t *palette);
+//Encodes a block whose visible pixels are all rgb with the endpoints that reproduce it most closely
+//Pixels in transparent_mask get the transparent entry of 3 color blocks, which alpha selects
+void EncodeSingleColorCMPR(uint8_t *dst, uint8_t *rgb, bool alpha, uint32_t transparent_mask);
+//Encodes one 4x4 block of RGBA8 pixels with CMPR_QUALITY_RANGE or CMPR_QUALITY_CLUSTER
+void FitBlockCMPR(uint8_t *dst, uint8_t *block, uint8_t quality, const CmprKernels &kernels);
@@ -0,0 +1,258 @@
+#define _CRT_SECURE_NO_WARNINGS
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <unordered_set>
+#include <vector>
+#include "mpanimbuild.h"
+#include "FormatSelect.h"
+#include "ThreadPool.h"
+
+static const char *format_names[TEX_FORMAT_COUNT] = { "RGBA8", "RGB5A3", "CI8", "CI4", "IA8", "IA4", "I8", "I4", "A8", "CMPR" };
+
+//Candidates grouped by bits per pixel from smallest to largest, the best PSNR within the first group with a passing format wins
+struct FormatCandidate {
+	uint8_t format;
+	int32_t group;
+};
+
+static const FormatCandidate format_candidates[] = {
+	{ TEX_FORMAT_I4, 0 },
+	{ TEX_FORMAT_CMPR, 0 },
+	{ TEX_FORMAT_CI4, 0 },
+	{ TEX_FORMAT_IA4, 1 },
+	{ TEX_FORMAT_I8, 1 },
+	{ TEX_FORMAT_A8, 1 },
+	{ TEX_FORMAT_CI8, 1 },
+	{ TEX_FORMAT_IA8, 2 },
+	{ TEX_FORMAT_RGB5A3, 2 },
+	{ TEX_FORMAT_RGBA8, 3 }
+};
+
+struct FormatError {
+	double psnr;
+	int32_t max_error;
+};
+
+static double GetPsnr(int32_t w, int32_t h, double squared_error)
+{
+	if (squared_error == 0.0) {
+		return INFINITY;
+	}
+	return 10.0 * log10((255.0 * 255.0) / (squared_error / ((double)w * h * 4.0)));
+}
+
+//Color differences are scaled by the source alpha since the color of invisible pixels doesn't matter
+static FormatError MeasureError(int32_t w, int32_t h, uint8_t *src, uint8_t *decoded)
+{
+	FormatError error = { INFINITY, 0 };
+	double squared_error = 0.0;
+	for (int32_t i = 0; i < w * h; i++) {
+		uint8_t *src_color = &src[i * 4];
+		uint8_t *dst_color = &decoded[i * 4];
+		for (int32_t j = 0; j < 4; j++) {
+			int32_t diff = abs((int32_t)src_color[j] - (int32_t)dst_color[j]);
+			if (j < 3) {
+				diff = (diff * src_color[3]) / 255;
+			}
+			squared_error += diff * diff;
+			if (diff > error.max_error) {
+				error.max_error = diff;
+			}
+		}
+	}
+	error.psnr = GetPsnr(w, h, squared_error);
+	return error;
+}
+
+//Smallest difference between alpha and an alpha the format decodes to
+static int32_t GetAlphaError(uint8_t format, int32_t alpha)
+{
+	int32_t error = 0;
+	switch (format) {
+		//Translucent RGB5A3 colors have 3 bits of alpha and opaque ones 255
+		case TEX_FORMAT_RGB5A3:
+		case TEX_FORMAT_CI8:
+		case TEX_FORMAT_CI4:
+			error = 255 - alpha;
+			for (int32_t i = 0; i < 8; i++) {
+				error = std::min(error, abs(((i << 5) | (i << 2) | (i >> 1)) - alpha));
+			}
+			break;
+
+		case TEX_FORMAT_IA4:
+		case TEX_FORMAT_I4:
+			error = std::min(alpha % 17, 17 - (alpha % 17));
+			break;
+
+		case TEX_FORMAT_CMPR:
+			error = std::min(alpha, 255 - alpha);
+			break;
+	}
+	return error;
+}
+
+static bool IsGrayFormat(uint8_t format)
+{
+	return format == TEX_FORMAT_IA8 || format == TEX_FORMAT_IA4 || format == TEX_FORMAT_I8 || format == TEX_FORMAT_I4 || format == TEX_FORMAT_A8;
+}
+
+//Texture statistics the error bounds are built from
+struct FormatStats {
+	uint32_t alpha_counts[256];
+	double gray_squared_error;
+	int32_t gray_max_error;
+	//Only filled in for opaque textures, error to the nearest opaque RGB5A3 color and the extra error of each nearest color's pixels if a palette lacks it sorted ascending
+	double rgb5a3_squared_error;
+	int32_t rgb5a3_max_error;
+	std::vector<double> rgb5a3_penalties;
+};
+
+//Opaque pixels are always closest to opaque RGB5A3 colors since translucent ones are at least 36 alpha off
+//Each channel is as close as its nearest 5-bit level and a different color is at least as far as the nearest channel's second nearest level
+static void GetRGB5A3Stats(int32_t w, int32_t h, uint8_t *data, FormatStats &stats)
+{
+	uint8_t nearest_levels[256];
+	int32_t nearest_diffs[256];
+	int32_t second_diffs[256];
+	for (int32_t i = 0; i < 256; i++) {
+		nearest_diffs[i] = second_diffs[i] = 256;
+		for (int32_t j = 0; j < 32; j++) {
+			int32_t diff = abs(((j << 3) | (j >> 2)) - i);
+			if (diff < nearest_diffs[i]) {
+				second_diffs[i] = nearest_diffs[i];
+				nearest_diffs[i] = diff;
+				nearest_levels[i] = j;
+			} else if (diff < second_diffs[i]) {
+				second_diffs[i] = diff;
+			}
+		}
+	}
+	std::vector<double> penalties(32768, -1.0);
+	for (int32_t i = 0; i < w * h; i++) {
+		uint8_t *color = &data[(size_t)i * 4];
+		uint32_t nearest = (nearest_levels[color[0]] << 10) | (nearest_levels[color[1]] << 5) | nearest_levels[color[2]];
+		int32_t penalty = 65536;
+		for (int32_t j = 0; j < 3; j++) {
+			int32_t nearest_diff = nearest_diffs[color[j]];
+			int32_t second_diff = second_diffs[color[j]];
+			stats.rgb5a3_squared_error += nearest_diff * nearest_diff;
+			stats.rgb5a3_max_error = std::max(stats.rgb5a3_max_error, nearest_diff);
+			penalty = std::min(penalty, (second_diff * second_diff) - (nearest_diff * nearest_diff));
+		}
+		penalties[nearest] = std::max(penalties[nearest], 0.0) + penalty;
+	}
+	for (size_t i = 0; i < penalties.size(); i++) {
+		if (penalties[i] >= 0.0) {
+			stats.rgb5a3_penalties.push_back(penalties[i]);
+		}
+	}
+	std::sort(stats.rgb5a3_penalties.begin(), stats.rgb5a3_penalties.end());
+}
+
+//Error the format has at least however it is encoded, so formats failing this never need encoding
+//Alpha can only be as close as the alphas the format has, and gray formats are off by half the spread of each color's channels
+//Opaque RGB5A3 colors are off by the nearest RGB5A3 color, and palettes too small for every nearest color by the cheapest ones left out
+static FormatError GetErrorBound(uint8_t format, int32_t w, int32_t h, bool opaque, const FormatStats &stats)
+{
+	FormatError bound = { INFINITY, 0 };
+	double squared_error = 0.0;
+	for (int32_t i = 0; i < 256; i++) {
+		if (stats.alpha_counts[i] != 0) {
+			int32_t error = GetAlphaError(format, i);
+			squared_error += (double)error * error * stats.alpha_counts[i];
+			bound.max_error = std::max(bound.max_error, error);
+		}
+	}
+	if (IsGrayFormat(format)) {
+		squared_error += stats.gray_squared_error;
+		bound.max_error = std::max(bound.max_error, stats.gray_max_error);
+	}
+	if (opaque && (format == TEX_FORMAT_RGB5A3 || format == TEX_FORMAT_CI8 || format == TEX_FORMAT_CI4)) {
+		squared_error += stats.rgb5a3_squared_error;
+		bound.max_error = std::max(bound.max_error, stats.rgb5a3_max_error);
+		size_t palette_size = (format == TEX_FORMAT_CI4) ? 16 : 256;
+		if (format != TEX_FORMAT_RGB5A3 && stats.rgb5a3_penalties.size() > palette_size) {
+			for (size_t i = 0; i < stats.rgb5a3_penalties.size() - palette_size; i++) {
+				squared_error += stats.rgb5a3_penalties[i];
+			}
+		}
+	}
+	bound.psnr = GetPsnr(w, h, squared_error);
+	return bound;
+}
+
+uint8_t FormatSelect::Choose(int32_t w, int32_t h, uint8_t *data, uint8_t cmpr_quality, const EncodeOptions &options, EncodedTexture &encoded,
+	std::string &report)
+{
+	bool grayscale = true;
+	bool opaque = true;
+	bool binary_alpha = true;
+	std::unordered_set<uint32_t> colors;
+	FormatStats stats = {};
+	for (int32_t i = 0; i < w * h; i++) {
+		uint8_t *color = &data[i * 4];
+		if (color[3] != 0 && (color[0] != color[1] || color[1] != color[2])) {
+			grayscale = false;
+		}
+		if (color[3] != 255) {
+			opaque = false;
+			if (color[3] != 0) {
+				binary_alpha = false;
+			}
+		}
+		colors.insert(color[0] | (color[1] << 8) | (color[2] << 16) | ((uint32_t)color[3] << 24));
+		stats.alpha_counts[color[3]]++;
+		int32_t spread = std::max(color[0], std::max(color[1], color[2])) - std::min(color[0], std::min(color[1], color[2]));
+		int32_t gray_error = (((spread + 1) / 2) * color[3]) / 255;
+		stats.gray_squared_error += gray_error * gray_error;
+		stats.gray_max_error = std::max(stats.gray_max_error, gray_error);
+	}
+	if (opaque) {
+		GetRGB5A3Stats(w, h, data, stats);
+	}
+	uint8_t best_format = TEX_FORMAT_RGBA8;
+	FormatError best_error = { -1.0, 0 };
+	int32_t group_count = format_candidates[(sizeof(format_candidates) / sizeof(format_candidates[0])) - 1].group + 1;
+	for (int32_t group = 0; group < group_count && best_error.psnr < 0.0; group++) {
+		std::vector<uint8_t> formats;
+		for (size_t i = 0; i < sizeof(format_candidates) / sizeof(format_candidates[0]); i++) {
+			uint8_t format = format_candidates[i].format;
+			if (format_candidates[i].group != group) {
+				continue;
+			}
+			FormatError bound = GetErrorBound(format, w, h, opaque, stats);
+			if (bound.psnr >= options.auto_psnr && bound.max_error <= options.auto_max_error) {
+				formats.push_back(format);
+			}
+		}
+		std::vector<EncodedTexture> outputs(formats.size());
+		std::vector<FormatError> errors(formats.size());
+		ThreadPool::Get()->ParallelFor(formats.size(), [&](uint32_t i) {
+			std::vector<uint8_t> decoded((size_t)w * h * 4);
+			TextureEncodeCached(formats[i], w, h, data, outputs[i], cmpr_quality, options);
+			TextureDecode(formats[i], w, h, outputs[i].pal_data.data(), outputs[i].tex_data.data(), decoded.data());
+			errors[i] = MeasureError(w, h, data, decoded.data());
+		});
+		for (size_t i = 0; i < formats.size(); i++) {
+			if (errors[i].psnr >= options.auto_psnr && errors[i].max_error <= options.auto_max_error && errors[i].psnr > best_error.psnr) {
+				best_format = formats[i];
+				best_error = errors[i];
+				encoded = std::move(outputs[i]);
+			}
+		}
+	}
+	char psnr_text[32];
+	if (isinf(best_error.psnr)) {
+		snprintf(psnr_text, sizeof(psnr_text), "lossless");
+	} else {
+		snprintf(psnr_text, sizeof(psnr_text), "%.1f dB", best_error.psnr);
+	}
+	char text[256];
+	snprintf(text, sizeof(text), "auto format %s, %s, max error %d (%s, %s, %u colors)", format_names[best_format], psnr_text,
+		best_error.max_error, grayscale ? "grayscale" : "color", opaque ? "opaque" : (binary_alpha ? "binary alpha" : "translucent"),
+		(uint32_t)colors.size());
+	report = text;
+	return best_format;
+}
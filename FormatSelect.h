@@ -0,0 +1,20 @@
+#pragma once
+
+#include <stdint.h>
+#include <string>
+
+struct EncodeOptions;
+struct EncodedTexture;
+
+#define FORMAT_SELECT_DEFAULT_PSNR 40.0
+#define FORMAT_SELECT_DEFAULT_MAX_ERROR 255
+
+//Picks the smallest GX format for format="auto" textures that stays within an error budget
+class FormatSelect
+{
+public:
+	//Returns the chosen TEX_FORMAT_* with its output in encoded and describes why in report
+	//A format passes when its PSNR is at least options.auto_psnr dB and no channel is off by more than options.auto_max_error
+	static uint8_t Choose(int32_t w, int32_t h, uint8_t *data, uint8_t cmpr_quality, const EncodeOptions &options, EncodedTexture &encoded,
+		std::string &report);
+};
@@ -0,0 +1,113 @@
+#include <filesystem>
+#include <map>
+#include <mutex>
+#include "ImageCache.h"
+#include "mpanimbuild.h"
+#include "stb_image.h"
+
+//Least recently used images are dropped once the cache holds more than this
+#define IMAGE_CACHE_MAX_BYTES (512ULL * 1024 * 1024)
+
+struct ImageCacheEntry {
+	std::filesystem::file_time_type time;
+	uintmax_t file_size;
+	uint64_t last_use;
+	std::shared_ptr<DecodedImage> image;
+};
+
+static bool cache_enabled = false;
+static std::mutex cache_mutex;
+static std::map<std::string, ImageCacheEntry> cache_entries;
+static uint64_t cache_bytes = 0;
+static uint64_t cache_use_counter = 0;
+
+DecodedImage::DecodedImage()
+{
+	w = h = 0;
+	data = nullptr;
+}
+
+DecodedImage::~DecodedImage()
+{
+	if (data) {
+		stbi_image_free(data);
+	}
+}
+
+static std::shared_ptr<DecodedImage> DecodeImage(std::string path)
+{
+	std::shared_ptr<DecodedImage> image = std::make_shared<DecodedImage>();
+	int channels;
+	image->data = stbi_load(path.c_str(), &image->w, &image->h, &channels, 4);
+	if (!image->data) {
+		PrintError("Failed to load image %s: %s.\n", path.c_str(), stbi_failure_reason());
+	}
+	return image;
+}
+
+static void EvictImages()
+{
+	while (cache_bytes > IMAGE_CACHE_MAX_BYTES && !cache_entries.empty()) {
+		std::map<std::string, ImageCacheEntry>::iterator oldest = cache_entries.begin();
+		for (std::map<std::string, ImageCacheEntry>::iterator it = cache_entries.begin(); it != cache_entries.end(); it++) {
+			if (it->second.last_use < oldest->second.last_use) {
+				oldest = it;
+			}
+		}
+		cache_bytes -= (uint64_t)oldest->second.image->w * oldest->second.image->h * 4;
+		cache_entries.erase(oldest);
+	}
+}
+
+std::shared_ptr<DecodedImage> ImageCache::Load(std::string path)
+{
+	if (!cache_enabled) {
+		return DecodeImage(path);
+	}
+	std::error_code error;
+	std::filesystem::file_time_type time = std::filesystem::last_write_time(path, error);
+	uintmax_t file_size = std::filesystem::file_size(path, error);
+	if (error) {
+		return DecodeImage(path);
+	}
+	{
+		std::lock_guard<std::mutex> lock(cache_mutex);
+		std::map<std::string, ImageCacheEntry>::iterator it = cache_entries.find(path);
+		if (it != cache_entries.end()) {
+			if (it->second.time == time && it->second.file_size == file_size) {
+				it->second.last_use = ++cache_use_counter;
+				return it->second.image;
+			}
+			cache_bytes -= (uint64_t)it->second.image->w * it->second.image->h * 4;
+			cache_entries.erase(it);
+		}
+	}
+	std::shared_ptr<DecodedImage> image = DecodeImage(path);
+	std::lock_guard<std::mutex> lock(cache_mutex);
+	if (cache_entries.find(path) == cache_entries.end()) {
+		ImageCacheEntry entry;
+		entry.time = time;
+		entry.file_size = file_size;
+		entry.last_use = ++cache_use_counter;
+		entry.image = image;
+		cache_entries[path] = entry;
+		cache_bytes += (uint64_t)image->w * image->h * 4;
+		EvictImages();
+	}
+	return image;
+}
+
+void ImageCache::SetEnabled(bool enabled)
+{
+	cache_enabled = enabled;
+	if (!enabled) {
+		Clear();
+	}
+}
+
+void ImageCache::Clear()
+{
+	std::lock_guard<std::mutex> lock(cache_mutex);
+	cache_entries.clear();
+	cache_bytes = 0;
+}
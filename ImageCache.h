@@ -0,0 +1,23 @@
+#pragma once
+
+#include <stdint.h>
+#include <memory>
+#include <string>
+
+struct DecodedImage {
+	int w;
+	int h;
+	uint8_t *data;
+
+	DecodedImage();
+	~DecodedImage();
+};
+
+//Decodes images to RGBA8, optionally keeping them in memory for later builds
+class ImageCache
+{
+public:
+	static std::shared_ptr<DecodedImage> Load(std::string path);
+	static void SetEnabled(bool enabled);
+	static void Clear();
+};
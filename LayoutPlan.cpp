@@ -0,0 +1,67 @@
+#include "LayoutPlan.h"
+#include "mpanimbuild.h"
+
+LayoutPlan::LayoutPlan()
+{
+	m_total_size = 0;
+}
+
+void LayoutPlan::Clear()
+{
+	m_sections.clear();
+	m_total_size = 0;
+}
+
+uint32_t LayoutPlan::AddSection(std::string name, uint32_t size, uint32_t alignment, uint8_t fill)
+{
+	LayoutSection section;
+	section.name = name;
+	section.ofs = ((m_total_size + alignment - 1) / alignment) * alignment;
+	section.size = size;
+	section.fill = fill;
+	m_sections.push_back(section);
+	m_total_size = section.ofs + size;
+	return m_sections.size() - 1;
+}
+
+uint32_t LayoutPlan::GetSectionCount()
+{
+	return m_sections.size();
+}
+
+uint32_t LayoutPlan::GetOffset(uint32_t section)
+{
+	return m_sections[section].ofs;
+}
+
+uint32_t LayoutPlan::GetSize(uint32_t section)
+{
+	return m_sections[section].size;
+}
+
+uint32_t LayoutPlan::GetEnd(uint32_t section)
+{
+	return m_sections[section].ofs + m_sections[section].size;
+}
+
+uint32_t LayoutPlan::GetTotalSize()
+{
+	return m_total_size;
+}
+
+void LayoutPlan::BeginSection(ByteWriter &writer, uint32_t section)
+{
+	size_t position = writer.GetPosition();
+	if (position > m_sections[section].ofs) {
+		PrintError("Section %s starts at 0x%x but was planned at 0x%x.\n", m_sections[section].name.c_str(), (uint32_t)position, m_sections[section].ofs);
+	}
+	writer.Pad(m_sections[section].ofs - position, m_sections[section].fill);
+}
+
+void LayoutPlan::EndSection(ByteWriter &writer, uint32_t section)
+{
+	size_t position = writer.GetPosition();
+	if (position != GetEnd(section)) {
+		PrintError("Section %s ends at 0x%x but was planned to end at 0x%x.\n", m_sections[section].name.c_str(), (uint32_t)position, GetEnd(section));
+	}
+}
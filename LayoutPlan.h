@@ -0,0 +1,38 @@
+#pragma once
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include "ByteWriter.h"
+
+struct LayoutSection {
+	std::string name;
+	uint32_t ofs;
+	uint32_t size;
+	uint8_t fill;
+};
+
+//Table of every section in an output file, computed before any bytes are written
+class LayoutPlan
+{
+public:
+	LayoutPlan();
+
+public:
+	void Clear();
+	//Places a section after the previous one, padding with fill up to alignment
+	uint32_t AddSection(std::string name, uint32_t size, uint32_t alignment = 1, uint8_t fill = 0);
+	uint32_t GetSectionCount();
+	uint32_t GetOffset(uint32_t section);
+	uint32_t GetSize(uint32_t section);
+	uint32_t GetEnd(uint32_t section);
+	uint32_t GetTotalSize();
+	//Pads up to the planned offset and errors if the writer is already past it
+	void BeginSection(ByteWriter &writer, uint32_t section);
+	//Errors if the section wrote a different number of bytes than planned
+	void EndSection(ByteWriter &writer, uint32_t section);
+
+private:
+	std::vector<LayoutSection> m_sections;
+	uint32_t m_total_size;
+};
@@ -0,0 +1,134 @@
+#include <stdio.h>
+#include "MappedFile.h"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+MappedFile::MappedFile()
+{
+	m_data = nullptr;
+	m_size = 0;
+#ifdef _WIN32
+	m_file = INVALID_HANDLE_VALUE;
+	m_mapping = nullptr;
+#else
+	m_fd = -1;
+#endif
+}
+
+MappedFile::~MappedFile()
+{
+	if (!m_path.empty()) {
+		Unmap();
+		remove(m_path.c_str());
+	}
+}
+
+#ifdef _WIN32
+
+bool MappedFile::Open(std::string path, size_t size)
+{
+	m_file = CreateFileA(path.c_str(), GENERIC_READ | GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (m_file == INVALID_HANDLE_VALUE) {
+		return false;
+	}
+	m_path = path;
+	m_size = size;
+	if (size == 0) {
+		return true;
+	}
+	LARGE_INTEGER file_size;
+	file_size.QuadPart = size;
+	if (!SetFilePointerEx(m_file, file_size, nullptr, FILE_BEGIN) || !SetEndOfFile(m_file)) {
+		return false;
+	}
+	m_mapping = CreateFileMappingA(m_file, nullptr, PAGE_READWRITE, 0, 0, nullptr);
+	if (!m_mapping) {
+		return false;
+	}
+	m_data = (uint8_t *)MapViewOfFile(m_mapping, FILE_MAP_WRITE, 0, 0, size);
+	return m_data != nullptr;
+}
+
+bool MappedFile::Unmap()
+{
+	bool success = true;
+	if (m_data && !UnmapViewOfFile(m_data)) {
+		success = false;
+	}
+	if (m_mapping && !CloseHandle(m_mapping)) {
+		success = false;
+	}
+	if (m_file != INVALID_HANDLE_VALUE && !CloseHandle(m_file)) {
+		success = false;
+	}
+	m_data = nullptr;
+	m_mapping = nullptr;
+	m_file = INVALID_HANDLE_VALUE;
+	return success;
+}
+
+#else
+
+bool MappedFile::Open(std::string path, size_t size)
+{
+	m_fd = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0666);
+	if (m_fd < 0) {
+		return false;
+	}
+	m_path = path;
+	m_size = size;
+	if (size == 0) {
+		return true;
+	}
+	if (ftruncate(m_fd, size) != 0) {
+		return false;
+	}
+	void *data = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, m_fd, 0);
+	if (data == MAP_FAILED) {
+		return false;
+	}
+	m_data = (uint8_t *)data;
+	return true;
+}
+
+bool MappedFile::Unmap()
+{
+	bool success = true;
+	if (m_data && munmap(m_data, m_size) != 0) {
+		success = false;
+	}
+	if (m_fd >= 0 && close(m_fd) != 0) {
+		success = false;
+	}
+	m_data = nullptr;
+	m_fd = -1;
+	return success;
+}
+
+#endif
+
+uint8_t *MappedFile::GetData()
+{
+	return m_data;
+}
+
+size_t MappedFile::GetSize()
+{
+	return m_size;
+}
+
+bool MappedFile::Close()
+{
+	if (!Unmap()) {
+		return false;
+	}
+	m_path.clear();
+	return true;
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <stdint.h>
+#include <string>
+
+//Output file of a known size mapped into memory so sections can be written in place
+class MappedFile
+{
+public:
+	MappedFile();
+	//Removes the file if it was never successfully closed
+	~MappedFile();
+
+public:
+	bool Open(std::string path, size_t size);
+	uint8_t *GetData();
+	size_t GetSize();
+	bool Close();
+
+private:
+	std::string m_path;
+	uint8_t *m_data;
+	size_t m_size;
+#ifdef _WIN32
+	void *m_file;
+	void *m_mapping;
+#else
+	int m_fd;
+#endif
+
+private:
+	bool Unmap();
+};
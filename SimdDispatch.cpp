@@ -0,0 +1,83 @@
+#include "SimdDispatch.h"
+
+#if defined(SIMD_X86) && defined(_MSC_VER)
+#include <intrin.h>
+#include <immintrin.h>
+#endif
+
+static int DetectLevel()
+{
+#if defined(SIMD_X86) && defined(_MSC_VER)
+	int info[4];
+	__cpuid(info, 0);
+	int max_leaf = info[0];
+	__cpuid(info, 1);
+	bool sse2 = (info[3] >> 26) & 1;
+	bool osxsave = (info[2] >> 27) & 1;
+	bool avx = (info[2] >> 28) & 1;
+	bool avx2 = false;
+	//The OS has to save the upper halves of the YMM registers too
+	if (max_leaf >= 7 && osxsave && avx && (_xgetbv(0) & 6) == 6) {
+		__cpuidex(info, 7, 0);
+		avx2 = (info[1] >> 5) & 1;
+	}
+#elif defined(SIMD_X86)
+	__builtin_cpu_init();
+	bool sse2 = __builtin_cpu_supports("sse2");
+	bool avx2 = __builtin_cpu_supports("avx2");
+#else
+	bool sse2 = false;
+	bool avx2 = false;
+#endif
+	if (avx2 && sse2) {
+		return SIMD_LEVEL_AVX2;
+	}
+	if (sse2) {
+		return SIMD_LEVEL_SSE2;
+	}
+	return SIMD_LEVEL_SCALAR;
+}
+
+int SimdDispatch::GetSupportedLevel()
+{
+	static int supported_level = DetectLevel();
+	return supported_level;
+}
+
+int SimdDispatch::ClampLevel(int level)
+{
+	if (level > GetSupportedLevel()) {
+		return GetSupportedLevel();
+	}
+	return level;
+}
+
+bool SimdDispatch::ParseLevel(std::string name, int &level)
+{
+	if (name == "auto") {
+		level = GetSupportedLevel();
+	} else if (name == "scalar") {
+		level = SIMD_LEVEL_SCALAR;
+	} else if (name == "sse2") {
+		level = SIMD_LEVEL_SSE2;
+	} else if (name == "avx2") {
+		level = SIMD_LEVEL_AVX2;
+	} else {
+		return false;
+	}
+	return true;
+}
+
+const char *SimdDispatch::GetLevelName(int level)
+{
+	switch (level) {
+		case SIMD_LEVEL_SSE2:
+			return "sse2";
+
+		case SIMD_LEVEL_AVX2:
+			return "avx2";
+
+		default:
+			return "scalar";
+	}
+}
@@ -0,0 +1,22 @@
+#pragma once
+
+#include <string>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define SIMD_X86
+#endif
+
+#define SIMD_LEVEL_SCALAR 0
+#define SIMD_LEVEL_SSE2 1
+#define SIMD_LEVEL_AVX2 2
+
+//Which SIMD code paths the CPU supports, the level a build uses is passed along in its EncodeOptions
+class SimdDispatch
+{
+public:
+	static int GetSupportedLevel();
+	//Lowers levels above what the CPU supports to the supported level
+	static int ClampLevel(int level);
+	static bool ParseLevel(std::string name, int &level);
+	static const char *GetLevelName(int level);
+};
@@ -0,0 +1,225 @@
+#define _CRT_SECURE_NO_WARNINGS
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#include "ImageCache.h"
+#include "mpanimbuild.h"
+#include "SimdDispatch.h"
+#include "TexBenchmark.h"
+#include "TexConvertSimd.h"
+
+#define BENCHMARK_DEFAULT_SIZE 1024
+#define BENCHMARK_DEFAULT_ITERATIONS 10
+
+struct BenchmarkFormat {
+	const char *name;
+	uint8_t format;
+};
+
+static BenchmarkFormat benchmark_formats[] = {
+	{ "RGBA8", TEX_FORMAT_RGBA8 },
+	{ "RGB5A3", TEX_FORMAT_RGB5A3 },
+	{ "IA8", TEX_FORMAT_IA8 },
+	{ "IA4", TEX_FORMAT_IA4 },
+	{ "I8", TEX_FORMAT_I8 },
+	{ "I4", TEX_FORMAT_I4 },
+	{ "A8", TEX_FORMAT_A8 },
+	{ "CMPR", TEX_FORMAT_CMPR },
+};
+
+//Benchmark image as RGBA8 rows and as the 4x4 blocks the CMPR kernels take
+struct BenchmarkImage {
+	std::vector<uint8_t> pixels;
+	std::vector<uint8_t> blocks;
+};
+
+//Runs one dispatch table entry at the given SIMD level over the whole benchmark image
+typedef void (*BenchmarkKernel)(int level, BenchmarkImage &image, std::vector<uint8_t> &dst);
+
+static void RunPackKernel(int level, BenchmarkImage &image, std::vector<uint8_t> &dst)
+{
+	dst.resize((image.pixels.size() / 4) * 2);
+	GetPackKernels(level).rgb5a3(image.pixels.data(), image.pixels.size() / 4, dst.data());
+}
+
+static void RunIntensityKernel(int level, BenchmarkImage &image, std::vector<uint8_t> &dst)
+{
+	dst.resize(image.pixels.size() / 4);
+	GetIntensityKernels(level).intensity(image.pixels.data(), image.pixels.size() / 4, dst.data());
+}
+
+static void RunIntensityAlphaKernel(int level, BenchmarkImage &image, std::vector<uint8_t> &dst)
+{
+	dst.resize(image.pixels.size() / 4);
+	GetIntensityKernels(level).intensity_alpha(image.pixels.data(), image.pixels.size() / 4, dst.data());
+}
+
+static void RunFindEndpointsKernel(int level, BenchmarkImage &image, std::vector<uint8_t> &dst)
+{
+	CmprKernels kernels = GetCmprKernels(level);
+	size_t num_blocks = image.blocks.size() / 64;
+	dst.resize(num_blocks * 3 * sizeof(int32_t));
+	int32_t *results = (int32_t *)dst.data();
+	for (size_t i = 0; i < num_blocks; i++) {
+		results[i * 3] = kernels.find_endpoints(&image.blocks[i * 64], 0x7FFF, &results[(i * 3) + 1], &results[(i * 3) + 2]);
+	}
+}
+
+static void RunSelectIndicesKernel(int level, BenchmarkImage &image, std::vector<uint8_t> &dst)
+{
+	CmprKernels kernels = GetCmprKernels(level);
+	size_t num_blocks = image.blocks.size() / 64;
+	dst.resize(num_blocks * 16 * sizeof(int32_t));
+	int32_t *indices = (int32_t *)dst.data();
+	for (size_t i = 0; i < num_blocks; i++) {
+		//Pixels along the diagonal stand in for the palette the encoder would build
+		uint8_t palette[16];
+		for (int32_t j = 0; j < 4; j++) {
+			memcpy(&palette[j * 4], &image.blocks[(i * 64) + (j * 20)], 3);
+			palette[(j * 4) + 3] = 255;
+		}
+		kernels.select_indices(palette, 4, &image.blocks[i * 64], &indices[i * 16]);
+	}
+}
+
+struct BenchmarkKernelEntry {
+	const char *name;
+	BenchmarkKernel run;
+};
+
+static BenchmarkKernelEntry benchmark_kernels[] = {
+	{ "rgb5a3", RunPackKernel },
+	{ "intensity", RunIntensityKernel },
+	{ "intensity_alpha", RunIntensityAlphaKernel },
+	{ "find_endpoints", RunFindEndpointsKernel },
+	{ "select_indices", RunSelectIndicesKernel },
+};
+
+//Returns the fastest of several runs in milliseconds
+static double TimeEncoder(int32_t iterations, std::function<void()> encode)
+{
+	double best = 0;
+	for (int32_t i = 0; i < iterations; i++) {
+		auto start = std::chrono::steady_clock::now();
+		encode();
+		std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+		if (i == 0 || elapsed.count() < best) {
+			best = elapsed.count();
+		}
+	}
+	return best;
+}
+
+int RunTextureBenchmark(std::vector<std::string> args)
+{
+	int32_t iterations = BENCHMARK_DEFAULT_ITERATIONS;
+	EncodeOptions options = GetDefaultEncodeOptions();
+	std::string image_path;
+	for (size_t i = 0; i < args.size(); i++) {
+		if (args[i] == "-iterations" && i + 1 < args.size()) {
+			iterations = atoi(args[++i].c_str());
+		} else if (args[i] == "-simd" && i + 1 < args.size()) {
+			int level;
+			if (!SimdDispatch::ParseLevel(args[++i], level)) {
+				fprintf(stderr, "Unknown SIMD level %s.\n", args[i].c_str());
+				return 1;
+			}
+			options.simd_level = SimdDispatch::ClampLevel(level);
+		} else {
+			image_path = args[i];
+		}
+	}
+	if (iterations < 1) {
+		iterations = 1;
+	}
+	int32_t w = BENCHMARK_DEFAULT_SIZE;
+	int32_t h = BENCHMARK_DEFAULT_SIZE;
+	BenchmarkImage benchmark_image;
+	std::vector<uint8_t> &pixels = benchmark_image.pixels;
+	if (!image_path.empty()) {
+		try {
+			std::shared_ptr<DecodedImage> image = ImageCache::Load(image_path);
+			w = image->w;
+			h = image->h;
+			pixels.assign(image->data, image->data + (w * h * 4));
+		} catch (BuildError &error) {
+			fprintf(stderr, "%s", error.what());
+			return 1;
+		}
+	} else {
+		//Fixed seed noise so runs are comparable
+		uint32_t seed = 1;
+		pixels.resize(w * h * 4);
+		for (size_t i = 0; i < pixels.size(); i++) {
+			seed = (seed * 1103515245) + 12345;
+			pixels[i] = seed >> 16;
+		}
+	}
+	//Blocks of 4x4 pixels in the layout the CMPR kernels take, edge pixels repeat for sizes that aren't a multiple of 4
+	std::vector<uint8_t> &blocks = benchmark_image.blocks;
+	for (int32_t y = 0; y < h; y += 4) {
+		for (int32_t x = 0; x < w; x += 4) {
+			for (int32_t i = 0; i < 16; i++) {
+				int32_t pixel_x = std::min(x + (i % 4), w - 1);
+				int32_t pixel_y = std::min(y + (i / 4), h - 1);
+				uint8_t *pixel = &pixels[(((size_t)pixel_y * w) + pixel_x) * 4];
+				blocks.insert(blocks.end(), pixel, pixel + 4);
+			}
+		}
+	}
+	//Every level from scalar up to the chosen one is timed, scalar output is the reference the others must match
+	int32_t num_levels = options.simd_level + 1;
+	printf("%dx%d, best of %d runs\n", w, h, iterations);
+	printf("%-16s", "Encoder");
+	for (int32_t level = 0; level < num_levels; level++) {
+		printf(" %10s", SimdDispatch::GetLevelName(level));
+	}
+	printf(" %8s\n", "Speedup");
+	int result = 0;
+	for (size_t i = 0; i < sizeof(benchmark_formats) / sizeof(benchmark_formats[0]); i++) {
+		BenchmarkFormat &format = benchmark_formats[i];
+		uint32_t size = GetTexDataSize(format.format, w, h);
+		std::vector<uint8_t> reference(size);
+		std::vector<uint8_t> current(size);
+		std::vector<double> times(num_levels);
+		printf("%-16s", format.name);
+		for (int32_t level = 0; level < num_levels; level++) {
+			EncodeOptions level_options = options;
+			level_options.simd_level = level;
+			std::vector<uint8_t> &dst = (level == SIMD_LEVEL_SCALAR) ? reference : current;
+			times[level] = TimeEncoder(iterations, [&]() {
+				TextureEncode(format.format, w, h, pixels.data(), nullptr, dst.data(), CMPR_QUALITY_FAST, level_options);
+			});
+			printf(" %8.3fms", times[level]);
+			if (level != SIMD_LEVEL_SCALAR && reference != current) {
+				printf("\n%s %s output differs from scalar", SimdDispatch::GetLevelName(level), format.name);
+				result = 1;
+			}
+		}
+		printf(" %7.2fx\n", times[0] / times[num_levels - 1]);
+	}
+	for (size_t i = 0; i < sizeof(benchmark_kernels) / sizeof(benchmark_kernels[0]); i++) {
+		BenchmarkKernelEntry &kernel = benchmark_kernels[i];
+		std::vector<uint8_t> reference;
+		std::vector<uint8_t> current;
+		std::vector<double> times(num_levels);
+		printf("%-16s", kernel.name);
+		for (int32_t level = 0; level < num_levels; level++) {
+			std::vector<uint8_t> &dst = (level == SIMD_LEVEL_SCALAR) ? reference : current;
+			times[level] = TimeEncoder(iterations, [&]() {
+				kernel.run(level, benchmark_image, dst);
+			});
+			printf(" %8.3fms", times[level]);
+			if (level != SIMD_LEVEL_SCALAR && reference != current) {
+				printf("\n%s %s output differs from scalar", SimdDispatch::GetLevelName(level), kernel.name);
+				result = 1;
+			}
+		}
+		printf(" %7.2fx\n", times[0] / times[num_levels - 1]);
+	}
+	return result;
+}
\ No newline at end of file
@@ -0,0 +1,7 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+//Times the texture encoders and SIMD kernels at each SIMD level and checks they match the scalar output
+int RunTextureBenchmark(std::vector<std::string> args);
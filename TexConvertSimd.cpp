@@ -0,0 +1,396 @@
+#include <string.h>
+#include "TexConvertSimd.h"
+#include "tex_convert.h"
+
+#ifdef SIMD_X86
+
+#include <emmintrin.h>
+#include <immintrin.h>
+
+//MSVC allows any intrinsic without compiler flags, GCC and Clang need the target per function
+#ifdef _MSC_VER
+#define TARGET_AVX2
+#else
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+
+//Pixels are RGBA8 with alpha cleared so only RGB contributes to distances
+#define RGB_MASK 0x00FFFFFF
+
+static uint32_t LoadColor(uint8_t *color)
+{
+	uint32_t value;
+	memcpy(&value, color, 4);
+	return value & RGB_MASK;
+}
+
+//Squared RGB distance between 4 pixels and one color as 32-bit integers
+static inline __m128i Distance4SSE2(__m128i pixels, __m128i color)
+{
+	__m128i zero = _mm_setzero_si128();
+	__m128i diff_lo = _mm_sub_epi16(_mm_unpacklo_epi8(pixels, zero), _mm_unpacklo_epi8(color, zero));
+	__m128i diff_hi = _mm_sub_epi16(_mm_unpackhi_epi8(pixels, zero), _mm_unpackhi_epi8(color, zero));
+	//Each pixel becomes R*R+G*G and B*B, which are then added together
+	__m128 sum_lo = _mm_castsi128_ps(_mm_madd_epi16(diff_lo, diff_lo));
+	__m128 sum_hi = _mm_castsi128_ps(_mm_madd_epi16(diff_hi, diff_hi));
+	__m128i rg = _mm_castps_si128(_mm_shuffle_ps(sum_lo, sum_hi, _MM_SHUFFLE(2, 0, 2, 0)));
+	__m128i b = _mm_castps_si128(_mm_shuffle_ps(sum_lo, sum_hi, _MM_SHUFFLE(3, 1, 3, 1)));
+	return _mm_add_epi32(rg, b);
+}
+
+TARGET_AVX2 static inline __m256i Distance8AVX2(__m256i pixels, __m256i color)
+{
+	__m256i zero = _mm256_setzero_si256();
+	__m256i diff_lo = _mm256_sub_epi16(_mm256_unpacklo_epi8(pixels, zero), _mm256_unpacklo_epi8(color, zero));
+	__m256i diff_hi = _mm256_sub_epi16(_mm256_unpackhi_epi8(pixels, zero), _mm256_unpackhi_epi8(color, zero));
+	__m256 sum_lo = _mm256_castsi256_ps(_mm256_madd_epi16(diff_lo, diff_lo));
+	__m256 sum_hi = _mm256_castsi256_ps(_mm256_madd_epi16(diff_hi, diff_hi));
+	//Unpacks and shuffles stay within 128-bit lanes so pixel order is preserved
+	__m256i rg = _mm256_castps_si256(_mm256_shuffle_ps(sum_lo, sum_hi, _MM_SHUFFLE(2, 0, 2, 0)));
+	__m256i b = _mm256_castps_si256(_mm256_shuffle_ps(sum_lo, sum_hi, _MM_SHUFFLE(3, 1, 3, 1)));
+	return _mm256_add_epi32(rg, b);
+}
+
+//Endpoint pairs are ranked by (distance << 8) | (255 - pair index)
+//so the largest key is the largest distance with the earliest pair on ties
+static int32_t DecodeEndpointKey(int32_t key, int32_t *col1, int32_t *col2)
+{
+	if (key < 0) {
+		return -1;
+	}
+	int32_t pair = 255 - (key & 0xFF);
+	*col1 = pair >> 4;
+	*col2 = pair & 0xF;
+	return key >> 8;
+}
+
+int32_t FindEndpointsCMPR_SSE2(uint8_t *block, uint32_t row_mask, int32_t *col1, int32_t *col2)
+{
+	__m128i rgb_mask = _mm_set1_epi32(RGB_MASK);
+	__m128i all_ones = _mm_set1_epi32(-1);
+	__m128i pixels[4];
+	__m128i pixel_idx[4];
+	__m128i best = all_ones;
+	for (int32_t k = 0; k < 4; k++) {
+		pixels[k] = _mm_and_si128(_mm_loadu_si128((__m128i *)&block[k * 16]), rgb_mask);
+		pixel_idx[k] = _mm_setr_epi32(k * 4, (k * 4) + 1, (k * 4) + 2, (k * 4) + 3);
+	}
+	for (int32_t i = 0; i < 15; i++) {
+		if (!(row_mask & (1 << i))) {
+			continue;
+		}
+		__m128i color = _mm_set1_epi32(LoadColor(&block[i * 4]));
+		__m128i row = _mm_set1_epi32(i);
+		__m128i key_base = _mm_set1_epi32(255 - (i * 16));
+		for (int32_t k = 0; k < 4; k++) {
+			__m128i dist = Distance4SSE2(pixels[k], color);
+			__m128i key = _mm_sub_epi32(_mm_add_epi32(_mm_slli_epi32(dist, 8), key_base), pixel_idx[k]);
+			__m128i valid = _mm_cmpgt_epi32(pixel_idx[k], row);
+			key = _mm_or_si128(_mm_and_si128(valid, key), _mm_andnot_si128(valid, all_ones));
+			__m128i greater = _mm_cmpgt_epi32(key, best);
+			best = _mm_or_si128(_mm_and_si128(greater, key), _mm_andnot_si128(greater, best));
+		}
+	}
+	int32_t keys[4];
+	_mm_storeu_si128((__m128i *)keys, best);
+	int32_t max_key = keys[0];
+	for (int32_t k = 1; k < 4; k++) {
+		if (keys[k] > max_key) {
+			max_key = keys[k];
+		}
+	}
+	return DecodeEndpointKey(max_key, col1, col2);
+}
+
+void SelectIndicesCMPR_SSE2(uint8_t *palette, int32_t count, uint8_t *block, int32_t *indices)
+{
+	__m128i rgb_mask = _mm_set1_epi32(RGB_MASK);
+	for (int32_t k = 0; k < 4; k++) {
+		__m128i pixels = _mm_and_si128(_mm_loadu_si128((__m128i *)&block[k * 16]), rgb_mask);
+		__m128i best_dist = Distance4SSE2(pixels, _mm_set1_epi32(LoadColor(&palette[0])));
+		__m128i best_idx = _mm_setzero_si128();
+		for (int32_t i = 1; i < count; i++) {
+			__m128i dist = Distance4SSE2(pixels, _mm_set1_epi32(LoadColor(&palette[i * 4])));
+			__m128i less = _mm_cmplt_epi32(dist, best_dist);
+			best_dist = _mm_or_si128(_mm_and_si128(less, dist), _mm_andnot_si128(less, best_dist));
+			best_idx = _mm_or_si128(_mm_and_si128(less, _mm_set1_epi32(i)), _mm_andnot_si128(less, best_idx));
+		}
+		_mm_storeu_si128((__m128i *)&indices[k * 4], best_idx);
+	}
+}
+
+TARGET_AVX2 int32_t FindEndpointsCMPR_AVX2(uint8_t *block, uint32_t row_mask, int32_t *col1, int32_t *col2)
+{
+	__m256i rgb_mask = _mm256_set1_epi32(RGB_MASK);
+	__m256i pixels[2];
+	__m256i pixel_idx[2];
+	__m256i best = _mm256_set1_epi32(-1);
+	for (int32_t k = 0; k < 2; k++) {
+		pixels[k] = _mm256_and_si256(_mm256_loadu_si256((__m256i *)&block[k * 32]), rgb_mask);
+		pixel_idx[k] = _mm256_setr_epi32(k * 8, (k * 8) + 1, (k * 8) + 2, (k * 8) + 3, (k * 8) + 4, (k * 8) + 5, (k * 8) + 6, (k * 8) + 7);
+	}
+	for (int32_t i = 0; i < 15; i++) {
+		if (!(row_mask & (1 << i))) {
+			continue;
+		}
+		__m256i color = _mm256_set1_epi32(LoadColor(&block[i * 4]));
+		__m256i row = _mm256_set1_epi32(i);
+		__m256i key_base = _mm256_set1_epi32(255 - (i * 16));
+		for (int32_t k = 0; k < 2; k++) {
+			__m256i dist = Distance8AVX2(pixels[k], color);
+			__m256i key = _mm256_sub_epi32(_mm256_add_epi32(_mm256_slli_epi32(dist, 8), key_base), pixel_idx[k]);
+			__m256i valid = _mm256_cmpgt_epi32(pixel_idx[k], row);
+			key = _mm256_blendv_epi8(_mm256_set1_epi32(-1), key, valid);
+			best = _mm256_max_epi32(best, key);
+		}
+	}
+	__m128i best4 = _mm_max_epi32(_mm256_castsi256_si128(best), _mm256_extracti128_si256(best, 1));
+	best4 = _mm_max_epi32(best4, _mm_shuffle_epi32(best4, _MM_SHUFFLE(1, 0, 3, 2)));
+	best4 = _mm_max_epi32(best4, _mm_shuffle_epi32(best4, _MM_SHUFFLE(2, 3, 0, 1)));
+	return DecodeEndpointKey(_mm_cvtsi128_si32(best4), col1, col2);
+}
+
+TARGET_AVX2 void SelectIndicesCMPR_AVX2(uint8_t *palette, int32_t count, uint8_t *block, int32_t *indices)
+{
+	__m256i rgb_mask = _mm256_set1_epi32(RGB_MASK);
+	for (int32_t k = 0; k < 2; k++) {
+		__m256i pixels = _mm256_and_si256(_mm256_loadu_si256((__m256i *)&block[k * 32]), rgb_mask);
+		__m256i best_dist = Distance8AVX2(pixels, _mm256_set1_epi32(LoadColor(&palette[0])));
+		__m256i best_idx = _mm256_setzero_si256();
+		for (int32_t i = 1; i < count; i++) {
+			__m256i dist = Distance8AVX2(pixels, _mm256_set1_epi32(LoadColor(&palette[i * 4])));
+			__m256i less = _mm256_cmpgt_epi32(best_dist, dist);
+			best_dist = _mm256_min_epi32(best_dist, dist);
+			best_idx = _mm256_blendv_epi8(best_idx, _mm256_set1_epi32(i), less);
+		}
+		_mm256_storeu_si256((__m256i *)&indices[k * 8], best_idx);
+	}
+}
+
+//Luminance in fixed point is t = 30 * R + 59 * G + 11 * B and I = t / 100, with the divide done as (t * 5243) >> 19
+//This matches the float math of GetIntensity for every RGB value where t is not a multiple of 100
+//When it is the exact result is a whole number and the float rounding of 0.3f, 0.59f and 0.11f can land one below it
+//(27809 of the 2^24 colors, including 48 of the 256 grays), so those lanes are redone with the same float operations
+//The alpha weighting (I * A) / 255 is exact for all 16-bit products as (x * 0x8081) >> 23
+//Both claims were checked against GetIntensity over all 2^24 colors and all 2^16 products
+#define INTENSITY_WEIGHT_R 30
+#define INTENSITY_WEIGHT_G 59
+#define INTENSITY_WEIGHT_B 11
+#define INTENSITY_DIV100_MUL 5243
+#define INTENSITY_DIV255_MUL 0x8081
+
+static inline uint8_t IntensityAlpha(uint8_t *color)
+{
+	return (GetIntensity(color) * color[3]) / 255;
+}
+
+//Intensity of 8 pixels as 16-bit integers, the alpha of each pixel is returned in alpha
+static inline __m128i Intensity8SSE2(uint8_t *src, __m128i *alpha)
+{
+	__m128i byte_mask = _mm_set1_epi32(0xFF);
+	__m128i pixels_lo = _mm_loadu_si128((__m128i *)src);
+	__m128i pixels_hi = _mm_loadu_si128((__m128i *)&src[16]);
+	__m128i r_lo = _mm_and_si128(pixels_lo, byte_mask);
+	__m128i r_hi = _mm_and_si128(pixels_hi, byte_mask);
+	__m128i g_lo = _mm_and_si128(_mm_srli_epi32(pixels_lo, 8), byte_mask);
+	__m128i g_hi = _mm_and_si128(_mm_srli_epi32(pixels_hi, 8), byte_mask);
+	__m128i b_lo = _mm_and_si128(_mm_srli_epi32(pixels_lo, 16), byte_mask);
+	__m128i b_hi = _mm_and_si128(_mm_srli_epi32(pixels_hi, 16), byte_mask);
+	*alpha = _mm_packs_epi32(_mm_srli_epi32(pixels_lo, 24), _mm_srli_epi32(pixels_hi, 24));
+	//t is at most 25500 so it fits in a signed 16-bit lane
+	__m128i t = _mm_mullo_epi16(_mm_packs_epi32(r_lo, r_hi), _mm_set1_epi16(INTENSITY_WEIGHT_R));
+	t = _mm_add_epi16(t, _mm_mullo_epi16(_mm_packs_epi32(g_lo, g_hi), _mm_set1_epi16(INTENSITY_WEIGHT_G)));
+	t = _mm_add_epi16(t, _mm_mullo_epi16(_mm_packs_epi32(b_lo, b_hi), _mm_set1_epi16(INTENSITY_WEIGHT_B)));
+	__m128i value = _mm_srli_epi16(_mm_mulhi_epu16(t, _mm_set1_epi16(INTENSITY_DIV100_MUL)), 3);
+	__m128i whole = _mm_cmpeq_epi16(_mm_mullo_epi16(value, _mm_set1_epi16(100)), t);
+	if (_mm_movemask_epi8(whole)) {
+		//Same operation order as GetIntensity: (R * 0.3f + G * 0.59f) + B * 0.11f
+		__m128 sum_lo = _mm_add_ps(_mm_mul_ps(_mm_cvtepi32_ps(r_lo), _mm_set1_ps(0.3f)), _mm_mul_ps(_mm_cvtepi32_ps(g_lo), _mm_set1_ps(0.59f)));
+		__m128 sum_hi = _mm_add_ps(_mm_mul_ps(_mm_cvtepi32_ps(r_hi), _mm_set1_ps(0.3f)), _mm_mul_ps(_mm_cvtepi32_ps(g_hi), _mm_set1_ps(0.59f)));
+		sum_lo = _mm_add_ps(sum_lo, _mm_mul_ps(_mm_cvtepi32_ps(b_lo), _mm_set1_ps(0.11f)));
+		sum_hi = _mm_add_ps(sum_hi, _mm_mul_ps(_mm_cvtepi32_ps(b_hi), _mm_set1_ps(0.11f)));
+		__m128i float_value = _mm_packs_epi32(_mm_cvttps_epi32(sum_lo), _mm_cvttps_epi32(sum_hi));
+		value = _mm_or_si128(_mm_and_si128(whole, float_value), _mm_andnot_si128(whole, value));
+	}
+	return value;
+}
+
+static inline __m128i MulDiv255SSE2(__m128i value, __m128i alpha)
+{
+	__m128i product = _mm_mullo_epi16(value, alpha);
+	return _mm_srli_epi16(_mm_mulhi_epu16(product, _mm_set1_epi16((int16_t)INTENSITY_DIV255_MUL)), 7);
+}
+
+void ConvertIntensity_SSE2(uint8_t *src, int32_t count, uint8_t *dst)
+{
+	__m128i alpha;
+	int32_t i = 0;
+	for (; i + 16 <= count; i += 16) {
+		__m128i value_lo = Intensity8SSE2(&src[i * 4], &alpha);
+		__m128i value_hi = Intensity8SSE2(&src[(i + 8) * 4], &alpha);
+		_mm_storeu_si128((__m128i *)&dst[i], _mm_packus_epi16(value_lo, value_hi));
+	}
+	for (; i < count; i++) {
+		dst[i] = GetIntensity(&src[i * 4]);
+	}
+}
+
+void ConvertIntensityAlpha_SSE2(uint8_t *src, int32_t count, uint8_t *dst)
+{
+	__m128i alpha_lo, alpha_hi;
+	int32_t i = 0;
+	for (; i + 16 <= count; i += 16) {
+		__m128i value_lo = Intensity8SSE2(&src[i * 4], &alpha_lo);
+		__m128i value_hi = Intensity8SSE2(&src[(i + 8) * 4], &alpha_hi);
+		value_lo = MulDiv255SSE2(value_lo, alpha_lo);
+		value_hi = MulDiv255SSE2(value_hi, alpha_hi);
+		_mm_storeu_si128((__m128i *)&dst[i], _mm_packus_epi16(value_lo, value_hi));
+	}
+	for (; i < count; i++) {
+		dst[i] = IntensityAlpha(&src[i * 4]);
+	}
+}
+
+//AVX2 version of Intensity8SSE2 for 16 pixels, 32-bit to 16-bit packs stay within 128-bit lanes
+//so the result holds pixels 0-3, 8-11, 4-7 and 12-15 in that order
+TARGET_AVX2 static inline __m256i Intensity16AVX2(uint8_t *src, __m256i *alpha)
+{
+	__m256i byte_mask = _mm256_set1_epi32(0xFF);
+	__m256i pixels_lo = _mm256_loadu_si256((__m256i *)src);
+	__m256i pixels_hi = _mm256_loadu_si256((__m256i *)&src[32]);
+	__m256i r_lo = _mm256_and_si256(pixels_lo, byte_mask);
+	__m256i r_hi = _mm256_and_si256(pixels_hi, byte_mask);
+	__m256i g_lo = _mm256_and_si256(_mm256_srli_epi32(pixels_lo, 8), byte_mask);
+	__m256i g_hi = _mm256_and_si256(_mm256_srli_epi32(pixels_hi, 8), byte_mask);
+	__m256i b_lo = _mm256_and_si256(_mm256_srli_epi32(pixels_lo, 16), byte_mask);
+	__m256i b_hi = _mm256_and_si256(_mm256_srli_epi32(pixels_hi, 16), byte_mask);
+	*alpha = _mm256_packs_epi32(_mm256_srli_epi32(pixels_lo, 24), _mm256_srli_epi32(pixels_hi, 24));
+	__m256i t = _mm256_mullo_epi16(_mm256_packs_epi32(r_lo, r_hi), _mm256_set1_epi16(INTENSITY_WEIGHT_R));
+	t = _mm256_add_epi16(t, _mm256_mullo_epi16(_mm256_packs_epi32(g_lo, g_hi), _mm256_set1_epi16(INTENSITY_WEIGHT_G)));
+	t = _mm256_add_epi16(t, _mm256_mullo_epi16(_mm256_packs_epi32(b_lo, b_hi), _mm256_set1_epi16(INTENSITY_WEIGHT_B)));
+	__m256i value = _mm256_srli_epi16(_mm256_mulhi_epu16(t, _mm256_set1_epi16(INTENSITY_DIV100_MUL)), 3);
+	__m256i whole = _mm256_cmpeq_epi16(_mm256_mullo_epi16(value, _mm256_set1_epi16(100)), t);
+	if (_mm256_movemask_epi8(whole)) {
+		__m256 sum_lo = _mm256_add_ps(_mm256_mul_ps(_mm256_cvtepi32_ps(r_lo), _mm256_set1_ps(0.3f)), _mm256_mul_ps(_mm256_cvtepi32_ps(g_lo), _mm256_set1_ps(0.59f)));
+		__m256 sum_hi = _mm256_add_ps(_mm256_mul_ps(_mm256_cvtepi32_ps(r_hi), _mm256_set1_ps(0.3f)), _mm256_mul_ps(_mm256_cvtepi32_ps(g_hi), _mm256_set1_ps(0.59f)));
+		sum_lo = _mm256_add_ps(sum_lo, _mm256_mul_ps(_mm256_cvtepi32_ps(b_lo), _mm256_set1_ps(0.11f)));
+		sum_hi = _mm256_add_ps(sum_hi, _mm256_mul_ps(_mm256_cvtepi32_ps(b_hi), _mm256_set1_ps(0.11f)));
+		__m256i float_value = _mm256_packs_epi32(_mm256_cvttps_epi32(sum_lo), _mm256_cvttps_epi32(sum_hi));
+		value = _mm256_blendv_epi8(value, float_value, whole);
+	}
+	return value;
+}
+
+TARGET_AVX2 static inline void StoreIntensity16AVX2(uint8_t *dst, __m256i value)
+{
+	value = _mm256_permute4x64_epi64(value, _MM_SHUFFLE(3, 1, 2, 0));
+	_mm_storeu_si128((__m128i *)dst, _mm_packus_epi16(_mm256_castsi256_si128(value), _mm256_extracti128_si256(value, 1)));
+}
+
+TARGET_AVX2 void ConvertIntensity_AVX2(uint8_t *src, int32_t count, uint8_t *dst)
+{
+	__m256i alpha;
+	int32_t i = 0;
+	for (; i + 16 <= count; i += 16) {
+		StoreIntensity16AVX2(&dst[i], Intensity16AVX2(&src[i * 4], &alpha));
+	}
+	for (; i < count; i++) {
+		dst[i] = GetIntensity(&src[i * 4]);
+	}
+}
+
+TARGET_AVX2 void ConvertIntensityAlpha_AVX2(uint8_t *src, int32_t count, uint8_t *dst)
+{
+	__m256i alpha;
+	int32_t i = 0;
+	for (; i + 16 <= count; i += 16) {
+		__m256i value = Intensity16AVX2(&src[i * 4], &alpha);
+		__m256i product = _mm256_mullo_epi16(value, alpha);
+		value = _mm256_srli_epi16(_mm256_mulhi_epu16(product, _mm256_set1_epi16((int16_t)INTENSITY_DIV255_MUL)), 7);
+		StoreIntensity16AVX2(&dst[i], value);
+	}
+	for (; i < count; i++) {
+		dst[i] = IntensityAlpha(&src[i * 4]);
+	}
+}
+
+//The color_8_to_N tables hold (x * (2^N - 1) + 127) / 255, the divide uses the same multiply as the alpha weighting
+//Alpha maps to 7 in color_8_to_3 for 237 and up, which selects the opaque 1:5:5:5 layout
+#define RGB5A3_OPAQUE_ALPHA 237
+
+static inline __m128i Quantize8SSE2(__m128i value, int16_t max)
+{
+	__m128i scaled = _mm_add_epi16(_mm_mullo_epi16(value, _mm_set1_epi16(max)), _mm_set1_epi16(127));
+	return _mm_srli_epi16(_mm_mulhi_epu16(scaled, _mm_set1_epi16((int16_t)INTENSITY_DIV255_MUL)), 7);
+}
+
+//RGB5A3 values of 8 pixels as 16-bit integers
+static inline __m128i RGB5A3_8SSE2(uint8_t *src)
+{
+	__m128i byte_mask = _mm_set1_epi32(0xFF);
+	__m128i pixels_lo = _mm_loadu_si128((__m128i *)src);
+	__m128i pixels_hi = _mm_loadu_si128((__m128i *)&src[16]);
+	__m128i r = _mm_packs_epi32(_mm_and_si128(pixels_lo, byte_mask), _mm_and_si128(pixels_hi, byte_mask));
+	__m128i g = _mm_packs_epi32(_mm_and_si128(_mm_srli_epi32(pixels_lo, 8), byte_mask), _mm_and_si128(_mm_srli_epi32(pixels_hi, 8), byte_mask));
+	__m128i b = _mm_packs_epi32(_mm_and_si128(_mm_srli_epi32(pixels_lo, 16), byte_mask), _mm_and_si128(_mm_srli_epi32(pixels_hi, 16), byte_mask));
+	__m128i a = _mm_packs_epi32(_mm_srli_epi32(pixels_lo, 24), _mm_srli_epi32(pixels_hi, 24));
+	__m128i opaque_value = _mm_or_si128(_mm_set1_epi16((int16_t)0x8000), _mm_slli_epi16(Quantize8SSE2(r, 31), 10));
+	opaque_value = _mm_or_si128(opaque_value, _mm_or_si128(_mm_slli_epi16(Quantize8SSE2(g, 31), 5), Quantize8SSE2(b, 31)));
+	__m128i alpha_value = _mm_or_si128(_mm_slli_epi16(Quantize8SSE2(a, 7), 12), _mm_slli_epi16(Quantize8SSE2(r, 15), 8));
+	alpha_value = _mm_or_si128(alpha_value, _mm_or_si128(_mm_slli_epi16(Quantize8SSE2(g, 15), 4), Quantize8SSE2(b, 15)));
+	__m128i opaque = _mm_cmpgt_epi16(a, _mm_set1_epi16(RGB5A3_OPAQUE_ALPHA - 1));
+	return _mm_or_si128(_mm_and_si128(opaque, opaque_value), _mm_andnot_si128(opaque, alpha_value));
+}
+
+void ConvertRGB5A3_SSE2(uint8_t *src, int32_t count, uint8_t *dst)
+{
+	int32_t i = 0;
+	for (; i + 8 <= count; i += 8) {
+		__m128i value = RGB5A3_8SSE2(&src[i * 4]);
+		value = _mm_or_si128(_mm_slli_epi16(value, 8), _mm_srli_epi16(value, 8));
+		_mm_storeu_si128((__m128i *)&dst[i * 2], value);
+	}
+	for (; i < count; i++) {
+		ConvertColorRGB5A3(&dst[i * 2], &src[i * 4]);
+	}
+}
+
+TARGET_AVX2 static inline __m256i Quantize16AVX2(__m256i value, int16_t max)
+{
+	__m256i scaled = _mm256_add_epi16(_mm256_mullo_epi16(value, _mm256_set1_epi16(max)), _mm256_set1_epi16(127));
+	return _mm256_srli_epi16(_mm256_mulhi_epu16(scaled, _mm256_set1_epi16((int16_t)INTENSITY_DIV255_MUL)), 7);
+}
+
+//Pixel order matches Intensity16AVX2
+TARGET_AVX2 static inline __m256i RGB5A3_16AVX2(uint8_t *src)
+{
+	__m256i byte_mask = _mm256_set1_epi32(0xFF);
+	__m256i pixels_lo = _mm256_loadu_si256((__m256i *)src);
+	__m256i pixels_hi = _mm256_loadu_si256((__m256i *)&src[32]);
+	__m256i r = _mm256_packs_epi32(_mm256_and_si256(pixels_lo, byte_mask), _mm256_and_si256(pixels_hi, byte_mask));
+	__m256i g = _mm256_packs_epi32(_mm256_and_si256(_mm256_srli_epi32(pixels_lo, 8), byte_mask), _mm256_and_si256(_mm256_srli_epi32(pixels_hi, 8), byte_mask));
+	__m256i b = _mm256_packs_epi32(_mm256_and_si256(_mm256_srli_epi32(pixels_lo, 16), byte_mask), _mm256_and_si256(_mm256_srli_epi32(pixels_hi, 16), byte_mask));
+	__m256i a = _mm256_packs_epi32(_mm256_srli_epi32(pixels_lo, 24), _mm256_srli_epi32(pixels_hi, 24));
+	__m256i opaque_value = _mm256_or_si256(_mm256_set1_epi16((int16_t)0x8000), _mm256_slli_epi16(Quantize16AVX2(r, 31), 10));
+	opaque_value = _mm256_or_si256(opaque_value, _mm256_or_si256(_mm256_slli_epi16(Quantize16AVX2(g, 31), 5), Quantize16AVX2(b, 31)));
+	__m256i alpha_value = _mm256_or_si256(_mm256_slli_epi16(Quantize16AVX2(a, 7), 12), _mm256_slli_epi16(Quantize16AVX2(r, 15), 8));
+	alpha_value = _mm256_or_si256(alpha_value, _mm256_or_si256(_mm256_slli_epi16(Quantize16AVX2(g, 15), 4), Quantize16AVX2(b, 15)));
+	__m256i opaque = _mm256_cmpgt_epi16(a, _mm256_set1_epi16(RGB5A3_OPAQUE_ALPHA - 1));
+	return _mm256_blendv_epi8(alpha_value, opaque_value, opaque);
+}
+
+TARGET_AVX2 void ConvertRGB5A3_AVX2(uint8_t *src, int32_t count, uint8_t *dst)
+{
+	__m256i swap_bytes = _mm256_setr_epi8(1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14,
+		1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14);
+	int32_t i = 0;
+	for (; i + 16 <= count; i += 16) {
+		__m256i value = _mm256_permute4x64_epi64(RGB5A3_16AVX2(&src[i * 4]), _MM_SHUFFLE(3, 1, 2, 0));
+		_mm256_storeu_si256((__m256i *)&dst[i * 2], _mm256_shuffle_epi8(value, swap_bytes));
+	}
+	for (; i < count; i++) {
+		ConvertColorRGB5A3(&dst[i * 2], &src[i * 4]);
+	}
+}
+
+#endif
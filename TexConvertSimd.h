@@ -0,0 +1,45 @@
+#pragma once
+
+#include <stdint.h>
+#include "SimdDispatch.h"
+
+//Per block CMPR steps, the scalar versions in tex_convert.cpp are the reference that every SIMD version must match
+struct CmprKernels {
+	//Finds the first pair i < j with the largest RGB distance where bit i of row_mask is set, returns -1 if there is none
+	int32_t (*find_endpoints)(uint8_t *block, uint32_t row_mask, int32_t *col1, int32_t *col2);
+	//Picks the nearest of the first count palette entries for all 16 pixels, lowest index on ties
+	void (*select_indices)(uint8_t *palette, int32_t count, uint8_t *block, int32_t *indices);
+};
+
+//Whole texture luminance steps for the I4/I8/IA4/IA8 encoders, count pixels of RGBA8 in and one byte per pixel out
+//Every version must match GetIntensity bit for bit, see TexConvertSimd.cpp for how the fixed point versions do so
+struct IntensityKernels {
+	//Writes GetIntensity(pixel)
+	void (*intensity)(uint8_t *src, int32_t count, uint8_t *dst);
+	//Writes (GetIntensity(pixel) * alpha) / 255
+	void (*intensity_alpha)(uint8_t *src, int32_t count, uint8_t *dst);
+};
+
+//Whole texture color packing, count pixels of RGBA8 in and one big endian value per pixel out
+struct PackKernels {
+	//Writes EncodeRGB5A3(pixel)
+	void (*rgb5a3)(uint8_t *src, int32_t count, uint8_t *dst);
+};
+
+//Kernel tables for a SIMD_LEVEL_*, the scalar versions for levels the build has no code for
+CmprKernels GetCmprKernels(int level);
+IntensityKernels GetIntensityKernels(int level);
+PackKernels GetPackKernels(int level);
+
+#ifdef SIMD_X86
+int32_t FindEndpointsCMPR_SSE2(uint8_t *block, uint32_t row_mask, int32_t *col1, int32_t *col2);
+void SelectIndicesCMPR_SSE2(uint8_t *palette, int32_t count, uint8_t *block, int32_t *indices);
+int32_t FindEndpointsCMPR_AVX2(uint8_t *block, uint32_t row_mask, int32_t *col1, int32_t *col2);
+void SelectIndicesCMPR_AVX2(uint8_t *palette, int32_t count, uint8_t *block, int32_t *indices);
+void ConvertIntensity_SSE2(uint8_t *src, int32_t count, uint8_t *dst);
+void ConvertIntensityAlpha_SSE2(uint8_t *src, int32_t count, uint8_t *dst);
+void ConvertIntensity_AVX2(uint8_t *src, int32_t count, uint8_t *dst);
+void ConvertIntensityAlpha_AVX2(uint8_t *src, int32_t count, uint8_t *dst);
+void ConvertRGB5A3_SSE2(uint8_t *src, int32_t count, uint8_t *dst);
+void ConvertRGB5A3_AVX2(uint8_t *src, int32_t count, uint8_t *dst);
+#endif
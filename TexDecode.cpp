@@ -0,0 +1,124 @@
+#include <string.h>
+#include "mpanimbuild.h"
+#include "CmprFit.h"
+#include "TileEncoder.h"
+
+static uint8_t Expand3(uint32_t value)
+{
+	return (value << 5) | (value << 2) | (value >> 1);
+}
+
+static uint8_t Expand5(uint32_t value)
+{
+	return (value << 3) | (value >> 2);
+}
+
+static void DecodeRGB5A3(uint16_t value, uint8_t *dst)
+{
+	if (value & 0x8000) {
+		dst[0] = Expand5((value >> 10) & 0x1F);
+		dst[1] = Expand5((value >> 5) & 0x1F);
+		dst[2] = Expand5(value & 0x1F);
+		dst[3] = 255;
+	} else {
+		dst[0] = ((value >> 8) & 0xF) * 17;
+		dst[1] = ((value >> 4) & 0xF) * 17;
+		dst[2] = (value & 0xF) * 17;
+		dst[3] = Expand3((value >> 12) & 0x7);
+	}
+}
+
+//Reads the value TileEncoder stored for pixel (x, y)
+static uint32_t ReadTexel(const TexFormatInfo &info, int32_t w, uint8_t *tex, int32_t x, int32_t y)
+{
+	int32_t tile_pitch = (w + info.block_w - 1) / info.block_w;
+	int32_t tile_size = (info.block_w * info.block_h * info.bpp) / 8;
+	uint8_t *tile = &tex[(((y / info.block_h) * tile_pitch) + (x / info.block_w)) * tile_size];
+	int32_t tile_x = x % info.block_w;
+	int32_t tile_y = y % info.block_h;
+	if (info.bpp == 4) {
+		uint8_t value = tile[(tile_y * (info.block_w / 2)) + (tile_x / 2)];
+		return (tile_x % 2) ? (value & 0xF) : (value >> 4);
+	} else if (info.bpp == 8) {
+		return tile[(tile_y * info.block_w) + tile_x];
+	} else if (info.bpp == 16) {
+		uint8_t *value = &tile[((tile_y * info.block_w) + tile_x) * 2];
+		return (value[0] << 8) | value[1];
+	} else {
+		uint8_t *value = &tile[((tile_y * info.block_w) + tile_x) * 2];
+		return ((uint32_t)value[0] << 24) | (value[1] << 16) | (value[32] << 8) | value[33];
+	}
+}
+
+static void DecodeTextureCMPR(int32_t w, int32_t h, uint8_t *tex, uint8_t *dst)
+{
+	int32_t tile_pitch = (w + 7) / 8;
+	for (int32_t y = 0; y < h; y += 4) {
+		for (int32_t x = 0; x < w; x += 4) {
+			uint8_t *block = &tex[((((y / 8) * tile_pitch) + (x / 8)) * 32) + ((((y / 4) % 2) * 2) + ((x / 4) % 2)) * 8];
+			uint8_t palette[16];
+			DecodePaletteCMPR((block[0] << 8) | block[1], (block[2] << 8) | block[3], palette);
+			for (int32_t i = 0; i < 4 && y + i < h; i++) {
+				for (int32_t j = 0; j < 4 && x + j < w; j++) {
+					int32_t index = (block[4 + i] >> (6 - (j * 2))) & 0x3;
+					memcpy(&dst[(((y + i) * w) + x + j) * 4], &palette[index * 4], 4);
+				}
+			}
+		}
+	}
+}
+
+void TextureDecode(uint8_t format, int32_t w, int32_t h, uint8_t *pal, uint8_t *tex, uint8_t *dst)
+{
+	if (format >= TEX_FORMAT_COUNT) {
+		PrintError("Invalid texture format %d.\n", format);
+	}
+	if (format == TEX_FORMAT_CMPR) {
+		DecodeTextureCMPR(w, h, tex, dst);
+		return;
+	}
+	const TexFormatInfo &info = tex_format_info[format];
+	for (int32_t y = 0; y < h; y++) {
+		for (int32_t x = 0; x < w; x++) {
+			uint32_t value = ReadTexel(info, w, tex, x, y);
+			uint8_t *color = &dst[((y * w) + x) * 4];
+			switch (format) {
+				case TEX_FORMAT_RGBA8:
+					color[0] = (value >> 16) & 0xFF;
+					color[1] = (value >> 8) & 0xFF;
+					color[2] = value & 0xFF;
+					color[3] = value >> 24;
+					break;
+
+				case TEX_FORMAT_RGB5A3:
+					DecodeRGB5A3(value, color);
+					break;
+
+				case TEX_FORMAT_CI8:
+				case TEX_FORMAT_CI4:
+					DecodeRGB5A3((pal[value * 2] << 8) | pal[(value * 2) + 1], color);
+					break;
+
+				case TEX_FORMAT_IA8:
+					color[0] = color[1] = color[2] = value & 0xFF;
+					color[3] = value >> 8;
+					break;
+
+				case TEX_FORMAT_IA4:
+					color[0] = color[1] = color[2] = (value & 0xF) * 17;
+					color[3] = (value >> 4) * 17;
+					break;
+
+				//The hardware repeats intensity formats into alpha too
+				case TEX_FORMAT_I8:
+				case TEX_FORMAT_A8:
+					color[0] = color[1] = color[2] = color[3] = value;
+					break;
+
+				case TEX_FORMAT_I4:
+					color[0] = color[1] = color[2] = color[3] = value * 17;
+					break;
+			}
+		}
+	}
+}
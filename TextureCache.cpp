@@ -0,0 +1,213 @@
+#define _CRT_SECURE_NO_WARNINGS
+#include <atomic>
+#include <filesystem>
+#include <map>
+#include <mutex>
+#include <random>
+#include <utility>
+#include <stdio.h>
+#include "TextureCache.h"
+
+#define TEXTURE_CACHE_MAGIC 0x4354504D
+//Bump whenever encoder output changes so stale entries are never reused
+#define TEXTURE_CACHE_VERSION 5
+//Least recently used entries are dropped once the memory cache holds more than this
+#define TEXTURE_CACHE_MAX_MEMORY (256ULL * 1024 * 1024)
+
+struct TextureCacheHeader {
+	uint32_t magic;
+	uint32_t version;
+	uint64_t hash[2];
+	uint32_t pal_size;
+	uint32_t tex_size;
+};
+
+static std::atomic<uint32_t> cache_hits(0);
+static std::atomic<uint32_t> cache_misses(0);
+
+struct TextureMemoryEntry {
+	uint64_t last_use;
+	EncodedTexture texture;
+};
+
+static bool memory_enabled = false;
+static std::mutex memory_mutex;
+static std::map<std::pair<uint64_t, uint64_t>, TextureMemoryEntry> memory_entries;
+static uint64_t memory_bytes = 0;
+static uint64_t memory_use_counter = 0;
+
+void TextureCache::PrepareDirectory(const std::string &dir)
+{
+	if (dir.empty()) {
+		return;
+	}
+	std::error_code error;
+	std::filesystem::create_directories(dir, error);
+	if (error) {
+		PrintError("Failed to create texture cache directory %s.\n", dir.c_str());
+	}
+}
+
+void TextureCache::SetMemoryCacheEnabled(bool enabled)
+{
+	std::lock_guard<std::mutex> lock(memory_mutex);
+	memory_enabled = enabled;
+	if (!enabled) {
+		memory_entries.clear();
+		memory_bytes = 0;
+	}
+}
+
+bool TextureCache::IsEnabled(const EncodeOptions &options)
+{
+	return memory_enabled || !options.cache_dir.empty();
+}
+
+TextureCacheKey TextureCache::MakeKey(uint8_t format, uint8_t cmpr_quality, int32_t w, int32_t h, uint8_t *src)
+{
+	//Only CMPR output depends on the quality, so other formats share an entry whatever the attribute says
+	if (format != TEX_FORMAT_CMPR) {
+		cmpr_quality = CMPR_QUALITY_FAST;
+	}
+	uint32_t params[5] = { format, cmpr_quality, (uint32_t)w, (uint32_t)h, TEXTURE_CACHE_VERSION };
+	TextureCacheKey key;
+	key.hash[0] = HashData(src, (size_t)w * h * 4, HashData(params, sizeof(params), 0));
+	key.hash[1] = HashData(src, (size_t)w * h * 4, HashData(params, sizeof(params), 0x9E3779B97F4A7C15ULL));
+	return key;
+}
+
+TextureCacheKey TextureCache::CombineKeys(std::vector<TextureCacheKey> &keys)
+{
+	TextureCacheKey key;
+	key.hash[0] = HashData(keys.data(), keys.size() * sizeof(TextureCacheKey), 0);
+	key.hash[1] = HashData(keys.data(), keys.size() * sizeof(TextureCacheKey), 0x9E3779B97F4A7C15ULL);
+	return key;
+}
+
+std::string TextureCache::GetPath(const std::string &dir, const TextureCacheKey &key)
+{
+	char name[40];
+	snprintf(name, sizeof(name), "%016llx%016llx", (unsigned long long)key.hash[0], (unsigned long long)key.hash[1]);
+	return dir + "/" + name + ".gxt";
+}
+
+bool TextureCache::Load(const EncodeOptions &options, const TextureCacheKey &key, EncodedTexture &texture)
+{
+	if (LoadMemory(key, texture)) {
+		cache_hits++;
+		return true;
+	}
+	if (!options.cache_dir.empty() && LoadFile(options.cache_dir, key, texture)) {
+		StoreMemory(key, texture);
+		cache_hits++;
+		return true;
+	}
+	cache_misses++;
+	return false;
+}
+
+void TextureCache::Store(const EncodeOptions &options, const TextureCacheKey &key, const EncodedTexture &texture)
+{
+	StoreMemory(key, texture);
+	if (!options.cache_dir.empty()) {
+		StoreFile(options.cache_dir, key, texture);
+	}
+}
+
+bool TextureCache::LoadMemory(const TextureCacheKey &key, EncodedTexture &texture)
+{
+	std::lock_guard<std::mutex> lock(memory_mutex);
+	if (!memory_enabled) {
+		return false;
+	}
+	std::map<std::pair<uint64_t, uint64_t>, TextureMemoryEntry>::iterator it = memory_entries.find(std::make_pair(key.hash[0], key.hash[1]));
+	if (it == memory_entries.end()) {
+		return false;
+	}
+	it->second.last_use = ++memory_use_counter;
+	texture = it->second.texture;
+	return true;
+}
+
+void TextureCache::StoreMemory(const TextureCacheKey &key, const EncodedTexture &texture)
+{
+	std::lock_guard<std::mutex> lock(memory_mutex);
+	if (!memory_enabled || memory_entries.count(std::make_pair(key.hash[0], key.hash[1]))) {
+		return;
+	}
+	TextureMemoryEntry &entry = memory_entries[std::make_pair(key.hash[0], key.hash[1])];
+	entry.last_use = ++memory_use_counter;
+	entry.texture = texture;
+	memory_bytes += texture.pal_data.size() + texture.tex_data.size();
+	while (memory_bytes > TEXTURE_CACHE_MAX_MEMORY && !memory_entries.empty()) {
+		std::map<std::pair<uint64_t, uint64_t>, TextureMemoryEntry>::iterator oldest = memory_entries.begin();
+		for (std::map<std::pair<uint64_t, uint64_t>, TextureMemoryEntry>::iterator it = memory_entries.begin(); it != memory_entries.end(); it++) {
+			if (it->second.last_use < oldest->second.last_use) {
+				oldest = it;
+			}
+		}
+		memory_bytes -= oldest->second.texture.pal_data.size() + oldest->second.texture.tex_data.size();
+		memory_entries.erase(oldest);
+	}
+}
+
+bool TextureCache::LoadFile(const std::string &dir, const TextureCacheKey &key, EncodedTexture &texture)
+{
+	FILE *file = fopen(GetPath(dir, key).c_str(), "rb");
+	if (!file) {
+		return false;
+	}
+	TextureCacheHeader header;
+	bool valid = fread(&header, sizeof(header), 1, file) == 1 && header.magic == TEXTURE_CACHE_MAGIC
+		&& header.version == TEXTURE_CACHE_VERSION && header.hash[0] == key.hash[0] && header.hash[1] == key.hash[1];
+	if (valid) {
+		texture.pal_data.resize(header.pal_size);
+		texture.tex_data.resize(header.tex_size);
+		valid = fread(texture.pal_data.data(), 1, header.pal_size, file) == header.pal_size
+			&& fread(texture.tex_data.data(), 1, header.tex_size, file) == header.tex_size;
+	}
+	fclose(file);
+	return valid;
+}
+
+void TextureCache::StoreFile(const std::string &dir, const TextureCacheKey &key, const EncodedTexture &texture)
+{
+	static std::atomic<uint32_t> temp_counter(0);
+	std::string path = GetPath(dir, key);
+	//Write to a unique temporary name first so concurrent builds never see a partial entry
+	char suffix[32];
+	snprintf(suffix, sizeof(suffix), ".%08x%u.tmp", std::random_device()(), (uint32_t)temp_counter++);
+	std::string temp_path = path + suffix;
+	FILE *file = fopen(temp_path.c_str(), "wb");
+	if (!file) {
+		return;
+	}
+	TextureCacheHeader header;
+	header.magic = TEXTURE_CACHE_MAGIC;
+	header.version = TEXTURE_CACHE_VERSION;
+	header.hash[0] = key.hash[0];
+	header.hash[1] = key.hash[1];
+	header.pal_size = texture.pal_data.size();
+	header.tex_size = texture.tex_data.size();
+	bool success = fwrite(&header, sizeof(header), 1, file) == 1
+		&& fwrite(texture.pal_data.data(), 1, texture.pal_data.size(), file) == texture.pal_data.size()
+		&& fwrite(texture.tex_data.data(), 1, texture.tex_data.size(), file) == texture.tex_data.size();
+	success = (fclose(file) == 0) && success;
+	std::error_code error;
+	if (success) {
+		std::filesystem::rename(temp_path, path, error);
+	}
+	if (!success || error) {
+		std::filesystem::remove(temp_path, error);
+	}
+}
+
+uint32_t TextureCache::GetHitCount()
+{
+	return cache_hits;
+}
+
+uint32_t TextureCache::GetMissCount()
+{
+	return cache_misses;
+}
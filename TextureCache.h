@@ -0,0 +1,35 @@
+#pragma once
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include "mpanimbuild.h"
+
+struct TextureCacheKey {
+	uint64_t hash[2];
+};
+
+//Persistent store of encoded GX textures keyed by their decoded pixels and format
+class TextureCache
+{
+public:
+	//Creates the cache directory a build passes in its EncodeOptions
+	static void PrepareDirectory(const std::string &dir);
+	//Keeps encoded textures in memory too, for long-running build servers
+	static void SetMemoryCacheEnabled(bool enabled);
+	static bool IsEnabled(const EncodeOptions &options);
+	static TextureCacheKey MakeKey(uint8_t format, uint8_t cmpr_quality, int32_t w, int32_t h, uint8_t *src);
+	//Key for textures encoded together, such as the members of a palette group
+	static TextureCacheKey CombineKeys(std::vector<TextureCacheKey> &keys);
+	static bool Load(const EncodeOptions &options, const TextureCacheKey &key, EncodedTexture &texture);
+	static void Store(const EncodeOptions &options, const TextureCacheKey &key, const EncodedTexture &texture);
+	static uint32_t GetHitCount();
+	static uint32_t GetMissCount();
+
+private:
+	static std::string GetPath(const std::string &dir, const TextureCacheKey &key);
+	static bool LoadMemory(const TextureCacheKey &key, EncodedTexture &texture);
+	static void StoreMemory(const TextureCacheKey &key, const EncodedTexture &texture);
+	static bool LoadFile(const std::string &dir, const TextureCacheKey &key, EncodedTexture &texture);
+	static void StoreFile(const std::string &dir, const TextureCacheKey &key, const EncodedTexture &texture);
+};
@@ -0,0 +1,178 @@
+#include <atomic>
+#include <exception>
+#include <memory>
+#include "ThreadPool.h"
+
+struct ParallelForState {
+	std::function<void(uint32_t)> func;
+	uint32_t count;
+	std::atomic<uint32_t> next;
+	std::atomic<uint32_t> done;
+	std::atomic<bool> failed;
+	std::exception_ptr error;
+	std::mutex mutex;
+	std::condition_variable cond;
+};
+
+static uint32_t default_thread_count = 0;
+static std::mutex shared_pool_mutex;
+static ThreadPool *shared_pool = nullptr;
+
+static void RunParallelFor(ParallelForState *state)
+{
+	while (true) {
+		uint32_t idx = state->next.fetch_add(1);
+		if (idx >= state->count) {
+			break;
+		}
+		//Skip remaining work once anything has failed but still count it as done
+		if (!state->failed) {
+			try {
+				state->func(idx);
+			} catch (...) {
+				std::lock_guard<std::mutex> lock(state->mutex);
+				if (!state->error) {
+					state->error = std::current_exception();
+				}
+				state->failed = true;
+			}
+		}
+		if (state->done.fetch_add(1) + 1 == state->count) {
+			std::lock_guard<std::mutex> lock(state->mutex);
+			state->cond.notify_all();
+		}
+	}
+}
+
+ThreadPool::ThreadPool(uint32_t num_threads)
+{
+	m_exit = false;
+	StartWorkers(num_threads);
+}
+
+ThreadPool::~ThreadPool()
+{
+	StopWorkers();
+}
+
+void ThreadPool::StartWorkers(uint32_t num_threads)
+{
+	for (uint32_t i = 1; i < num_threads; i++) {
+		m_threads.push_back(std::thread(&ThreadPool::WorkerMain, this));
+	}
+}
+
+void ThreadPool::StopWorkers()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_exit = true;
+	}
+	m_cond.notify_all();
+	for (size_t i = 0; i < m_threads.size(); i++) {
+		m_threads[i].join();
+	}
+	m_threads.clear();
+	m_exit = false;
+}
+
+uint32_t ThreadPool::GetThreadCount()
+{
+	return m_threads.size() + 1;
+}
+
+void ThreadPool::WorkerMain()
+{
+	while (true) {
+		std::function<void()> task;
+		{
+			std::unique_lock<std::mutex> lock(m_mutex);
+			m_cond.wait(lock, [this] { return m_exit || !m_tasks.empty(); });
+			if (m_tasks.empty()) {
+				return;
+			}
+			task = std::move(m_tasks.front());
+			m_tasks.pop_front();
+		}
+		task();
+	}
+}
+
+void ThreadPool::ParallelFor(uint32_t count, std::function<void(uint32_t)> func)
+{
+	if (count == 0) {
+		return;
+	}
+	if (count == 1 || m_threads.empty()) {
+		for (uint32_t i = 0; i < count; i++) {
+			func(i);
+		}
+		return;
+	}
+	std::shared_ptr<ParallelForState> state = std::make_shared<ParallelForState>();
+	state->func = func;
+	state->count = count;
+	state->next = 0;
+	state->done = 0;
+	state->failed = false;
+	uint32_t num_helpers = count - 1;
+	if (num_helpers > m_threads.size()) {
+		num_helpers = m_threads.size();
+	}
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		for (uint32_t i = 0; i < num_helpers; i++) {
+			m_tasks.push_back([state] { RunParallelFor(state.get()); });
+		}
+	}
+	m_cond.notify_all();
+	//The caller claims work too so nested ParallelFor calls from busy workers can't deadlock
+	RunParallelFor(state.get());
+	{
+		std::unique_lock<std::mutex> lock(state->mutex);
+		state->cond.wait(lock, [&state] { return state->done == state->count; });
+	}
+	if (state->error) {
+		std::rethrow_exception(state->error);
+	}
+}
+
+ThreadPool *ThreadPool::Get()
+{
+	std::lock_guard<std::mutex> lock(shared_pool_mutex);
+	//Intentionally never destroyed so worker threads may still be running at exit
+	if (!shared_pool) {
+		shared_pool = new ThreadPool(GetDefaultThreadCount());
+	}
+	return shared_pool;
+}
+
+void ThreadPool::SetThreadCount(uint32_t num_threads)
+{
+	if (num_threads == 0) {
+		num_threads = 1;
+	}
+	std::lock_guard<std::mutex> lock(shared_pool_mutex);
+	if (!shared_pool) {
+		shared_pool = new ThreadPool(num_threads);
+	} else if (shared_pool->GetThreadCount() != num_threads) {
+		shared_pool->StopWorkers();
+		shared_pool->StartWorkers(num_threads);
+	}
+}
+
+void ThreadPool::SetDefaultThreadCount(uint32_t num_threads)
+{
+	default_thread_count = num_threads;
+}
+
+uint32_t ThreadPool::GetDefaultThreadCount()
+{
+	if (default_thread_count == 0) {
+		default_thread_count = std::thread::hardware_concurrency();
+		if (default_thread_count == 0) {
+			default_thread_count = 1;
+		}
+	}
+	return default_thread_count;
+}
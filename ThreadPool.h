@@ -0,0 +1,40 @@
+#pragma once
+
+#include <stdint.h>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class ThreadPool
+{
+public:
+	//Thread count includes the calling thread which always helps with ParallelFor
+	ThreadPool(uint32_t num_threads);
+	~ThreadPool();
+
+public:
+	uint32_t GetThreadCount();
+	//Runs func(0) to func(count-1) across the pool and returns once all have finished
+	//The first exception thrown by func is rethrown on the calling thread
+	void ParallelFor(uint32_t count, std::function<void(uint32_t)> func);
+	static ThreadPool *Get();
+	//Creates the shared pool or resizes it when num_threads differs, must not be called while it is busy
+	static void SetThreadCount(uint32_t num_threads);
+	static void SetDefaultThreadCount(uint32_t num_threads);
+	static uint32_t GetDefaultThreadCount();
+
+private:
+	std::vector<std::thread> m_threads;
+	std::deque<std::function<void()>> m_tasks;
+	std::mutex m_mutex;
+	std::condition_variable m_cond;
+	bool m_exit;
+
+private:
+	void StartWorkers(uint32_t num_threads);
+	void StopWorkers();
+	void WorkerMain();
+};
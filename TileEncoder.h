@@ -0,0 +1,161 @@
+#pragma once
+
+#include <stdint.h>
+#include "mpanimbuild.h"
+
+//Block geometry of every GX texture format, bpp is the size of one pixel in the encoded texture
+template <uint8_t Format> struct TexFormatTraits;
+
+template <> struct TexFormatTraits<TEX_FORMAT_RGBA8> {
+	static constexpr int32_t block_w = 4;
+	static constexpr int32_t block_h = 4;
+	static constexpr int32_t bpp = 32;
+};
+
+template <> struct TexFormatTraits<TEX_FORMAT_RGB5A3> {
+	static constexpr int32_t block_w = 4;
+	static constexpr int32_t block_h = 4;
+	static constexpr int32_t bpp = 16;
+};
+
+template <> struct TexFormatTraits<TEX_FORMAT_CI8> {
+	static constexpr int32_t block_w = 8;
+	static constexpr int32_t block_h = 4;
+	static constexpr int32_t bpp = 8;
+};
+
+template <> struct TexFormatTraits<TEX_FORMAT_CI4> {
+	static constexpr int32_t block_w = 8;
+	static constexpr int32_t block_h = 8;
+	static constexpr int32_t bpp = 4;
+};
+
+template <> struct TexFormatTraits<TEX_FORMAT_IA8> {
+	static constexpr int32_t block_w = 4;
+	static constexpr int32_t block_h = 4;
+	static constexpr int32_t bpp = 16;
+};
+
+template <> struct TexFormatTraits<TEX_FORMAT_IA4> {
+	static constexpr int32_t block_w = 8;
+	static constexpr int32_t block_h = 4;
+	static constexpr int32_t bpp = 8;
+};
+
+template <> struct TexFormatTraits<TEX_FORMAT_I8> {
+	static constexpr int32_t block_w = 8;
+	static constexpr int32_t block_h = 4;
+	static constexpr int32_t bpp = 8;
+};
+
+template <> struct TexFormatTraits<TEX_FORMAT_I4> {
+	static constexpr int32_t block_w = 8;
+	static constexpr int32_t block_h = 8;
+	static constexpr int32_t bpp = 4;
+};
+
+template <> struct TexFormatTraits<TEX_FORMAT_A8> {
+	static constexpr int32_t block_w = 8;
+	static constexpr int32_t block_h = 4;
+	static constexpr int32_t bpp = 8;
+};
+
+//Stored as 2x2 groups of 4x4 DXT1 style blocks
+template <> struct TexFormatTraits<TEX_FORMAT_CMPR> {
+	static constexpr int32_t block_w = 8;
+	static constexpr int32_t block_h = 8;
+	static constexpr int32_t bpp = 4;
+};
+
+//Encodes a texture tile by tile where encode(pixel) returns the encoded value of one source pixel
+//Values are stored big endian in the low bpp bits, RGBA8 values are packed as 0xAARRGGBB
+template <uint8_t Format>
+class TileEncoder
+{
+public:
+	static constexpr int32_t block_w = TexFormatTraits<Format>::block_w;
+	static constexpr int32_t block_h = TexFormatTraits<Format>::block_h;
+	static constexpr int32_t bpp = TexFormatTraits<Format>::bpp;
+	static constexpr int32_t tile_size = (block_w * block_h * bpp) / 8;
+
+	//Pixels outside the image are left untouched so dst must start zeroed
+	template <int32_t SrcPixelSize, typename PixelFunc>
+	static void Encode(int32_t w, int32_t h, uint8_t *src, uint8_t *dst, PixelFunc encode)
+	{
+		for (int32_t y = 0; y < h; y += block_h) {
+			int32_t tile_h = (h - y < block_h) ? (h - y) : block_h;
+			for (int32_t x = 0; x < w; x += block_w) {
+				int32_t tile_w = (w - x < block_w) ? (w - x) : block_w;
+				uint8_t *tile_src = &src[((y * w) + x) * SrcPixelSize];
+				if (tile_w == block_w && tile_h == block_h) {
+					//Constant bounds let the compiler unroll whole tiles
+					EncodeTile<SrcPixelSize>(block_w, block_h, w, tile_src, dst, encode);
+				} else {
+					EncodeTile<SrcPixelSize>(tile_w, tile_h, w, tile_src, dst, encode);
+				}
+				dst += tile_size;
+			}
+		}
+	}
+
+private:
+	template <int32_t SrcPixelSize, typename PixelFunc>
+	static inline void EncodeTile(int32_t tile_w, int32_t tile_h, int32_t w, uint8_t *src, uint8_t *dst, PixelFunc &encode)
+	{
+		for (int32_t i = 0; i < tile_h; i++) {
+			uint8_t *src_row = &src[i * w * SrcPixelSize];
+			for (int32_t j = 0; j < tile_w; j++) {
+				Store(dst, j, i, encode(&src_row[j * SrcPixelSize]));
+			}
+		}
+	}
+
+	static inline void Store(uint8_t *tile, int32_t x, int32_t y, uint32_t value)
+	{
+		if constexpr (bpp == 4) {
+			uint8_t *dst = &tile[(y * (block_w / 2)) + (x / 2)];
+			if (x % 2) {
+				*dst |= value;
+			} else {
+				*dst = value << 4;
+			}
+		} else if constexpr (bpp == 8) {
+			tile[(y * block_w) + x] = value;
+		} else if constexpr (bpp == 16) {
+			tile[(y * block_w * 2) + (x * 2)] = value >> 8;
+			tile[(y * block_w * 2) + (x * 2) + 1] = value & 0xFF;
+		} else {
+			//Alpha and red come first followed by green and blue 32 bytes later
+			uint8_t *dst = &tile[(y * block_w * 2) + (x * 2)];
+			dst[0] = value >> 24;
+			dst[1] = (value >> 16) & 0xFF;
+			dst[32] = (value >> 8) & 0xFF;
+			dst[33] = value & 0xFF;
+		}
+	}
+};
+
+struct TexFormatInfo {
+	int32_t block_w;
+	int32_t block_h;
+	int32_t bpp;
+};
+
+//Runtime lookup of TexFormatTraits, indexed by TEX_FORMAT_*
+template <uint8_t Format> constexpr TexFormatInfo MakeTexFormatInfo()
+{
+	return { TexFormatTraits<Format>::block_w, TexFormatTraits<Format>::block_h, TexFormatTraits<Format>::bpp };
+}
+
+static constexpr TexFormatInfo tex_format_info[TEX_FORMAT_COUNT] = {
+	MakeTexFormatInfo<TEX_FORMAT_RGBA8>(),
+	MakeTexFormatInfo<TEX_FORMAT_RGB5A3>(),
+	MakeTexFormatInfo<TEX_FORMAT_CI8>(),
+	MakeTexFormatInfo<TEX_FORMAT_CI4>(),
+	MakeTexFormatInfo<TEX_FORMAT_IA8>(),
+	MakeTexFormatInfo<TEX_FORMAT_IA4>(),
+	MakeTexFormatInfo<TEX_FORMAT_I8>(),
+	MakeTexFormatInfo<TEX_FORMAT_I4>(),
+	MakeTexFormatInfo<TEX_FORMAT_A8>(),
+	MakeTexFormatInfo<TEX_FORMAT_CMPR>()
+};
@@ -27,6 +27,7 @@ SOFTWARE.
 #include <math.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 
 #ifndef NULL
 #define NULL (0)
@@ -42,11 +43,22 @@ exq_data *exq_init()
 	int i;
 	exq_data *pExq;
 
-	pExq = (exq_data*)malloc(sizeof(exq_data));
+	/* zeroed so palette entries of empty nodes are deterministic */
+	pExq = (exq_data*)calloc(1, sizeof(exq_data));
 	
 	for(i = 0; i < EXQ_HASH_SIZE; i++)
 		pExq->pHash[i] = NULL;
 
+	pExq->pBlocks = NULL;
+	pExq->numHistograms = 0;
+	pExq->numAllocated = 0;
+	pExq->ppMembers = NULL;
+	pExq->ppMembersTemp = NULL;
+	pExq->ppEntries = NULL;
+	pExq->pNearestNode = NULL;
+	pExq->nearestValid = 0;
+	pExq->pSortItems = NULL;
+	pExq->pSortTemp = NULL;
 	pExq->numColors = 0;
 	pExq->optimized = 0;
 	pExq->transparency = 1;
@@ -62,19 +74,56 @@ void exq_no_transparency(exq_data *pExq)
 
 void exq_free(exq_data *pExq)
 {
-	int i;
-	exq_histogram *pCur, *pNext;
+	exq_block *pBlock, *pPrev;
 
-	for(i = 0; i < EXQ_HASH_SIZE; i++)
-		for(pCur = pExq->pHash[i]; pCur != NULL; pCur = pNext)
-		{
-			pNext = pCur->pNextInHash;
-			free(pCur);
-		}
+	for(pBlock = pExq->pBlocks; pBlock != NULL; pBlock = pPrev)
+	{
+		pPrev = pBlock->pPrev;
+		free(pBlock);
+	}
 
+	free(pExq->ppMembers);
+	free(pExq->ppMembersTemp);
+	free(pExq->ppEntries);
+	free(pExq->pNearestNode);
+	free(pExq->pSortItems);
+	free(pExq->pSortTemp);
 	free(pExq);
 }
 
+static exq_histogram *exq_alloc_histogram(exq_data *pExq)
+{
+	exq_block *pBlock = pExq->pBlocks;
+	exq_histogram *pHist;
+	int size;
+
+	if(pBlock == NULL || pBlock->numUsed == pBlock->numAllocated)
+	{
+		/* every earlier block is full, so this doubles the entries */
+		size = pExq->numHistograms;
+		if(size < EXQ_BLOCK_MIN_SIZE)
+			size = EXQ_BLOCK_MIN_SIZE;
+		if(size > EXQ_BLOCK_SIZE)
+			size = EXQ_BLOCK_SIZE;
+
+		/* one allocation with the entries right after the block header */
+		pBlock = (exq_block*)malloc(sizeof(exq_block) +
+			size * (sizeof(exq_histogram) + sizeof(exq_dither)));
+		pBlock->pPrev = pExq->pBlocks;
+		pBlock->numUsed = 0;
+		pBlock->numAllocated = size;
+		pBlock->hist = (exq_histogram*)(pBlock + 1);
+		pBlock->dither = (exq_dither*)(pBlock->hist + size);
+		pExq->pBlocks = pBlock;
+	}
+
+	pHist = &pBlock->hist[pBlock->numUsed];
+	pHist->pDither = &pBlock->dither[pBlock->numUsed];
+	pBlock->numUsed++;
+	pExq->numHistograms++;
+	return pHist;
+}
+
 static unsigned int exq_make_hash(unsigned int rgba)
 {
 	rgba -= (rgba >> 13) | (rgba << 19);
@@ -86,53 +135,162 @@ static unsigned int exq_make_hash(unsigned int rgba)
 	return rgba;
 }
 
-void exq_feed(exq_data *pExq, unsigned char *pData, int nPixels)
+/* adds num pixels of one color, new colors go to the front of their hash chain */
+static void exq_add_color(exq_data *pExq, unsigned char r, unsigned char g,
+						  unsigned char b, unsigned char a, int num)
 {
-	int i;
 	unsigned int hash;
-	unsigned char r, g, b, a;
 	exq_histogram *pCur;
 	unsigned char channelMask = 0xff00 >> pExq->numBitsPerChannel;
 
-	for(i = 0; i < nPixels; i++)
-	{
-		r = *pData++; g = *pData++; b = *pData++; a = *pData++;
-		hash = exq_make_hash(((unsigned int)r) | (((unsigned int)g) << 8) | (((unsigned int)b) << 16) | (((unsigned int)a) << 24));
+	hash = exq_make_hash(((unsigned int)r) | (((unsigned int)g) << 8) | (((unsigned int)b) << 16) | (((unsigned int)a) << 24));
 
-		pCur = pExq->pHash[hash];
-		while(pCur != NULL && (pCur->ored != r || pCur->ogreen != g ||
-			pCur->oblue != b || pCur->oalpha != a))
-			pCur = pCur->pNextInHash;
+	pCur = pExq->pHash[hash];
+	while(pCur != NULL && (pCur->ored != r || pCur->ogreen != g ||
+		pCur->oblue != b || pCur->oalpha != a))
+		pCur = pCur->pNextInHash;
 
-		if(pCur != NULL)
-			pCur->num++;
-		else
+	if(pCur != NULL)
+		pCur->num += num;
+	else
+	{
+		pCur = exq_alloc_histogram(pExq);
+		pCur->pNextInHash = pExq->pHash[hash];
+		pExq->pHash[hash] = pCur;
+		pCur->ored = r; pCur->ogreen = g; pCur->oblue = b; pCur->oalpha = a;
+		r &= channelMask; g &= channelMask; b &= channelMask;
+		pCur->color.r = r / 255.0f * SCALE_R;
+		pCur->color.g = g / 255.0f * SCALE_G;
+		pCur->color.b = b / 255.0f * SCALE_B;
+		pCur->color.a = a / 255.0f * SCALE_A;
+
+		if(pExq->transparency)
 		{
-			pCur = (exq_histogram*)malloc(sizeof(exq_histogram));
-			pCur->pNextInHash = pExq->pHash[hash];
-			pExq->pHash[hash] = pCur;
-			pCur->ored = r; pCur->ogreen = g; pCur->oblue = b; pCur->oalpha = a;
-			r &= channelMask; g &= channelMask; b &= channelMask;
-			pCur->color.r = r / 255.0f * SCALE_R;
-			pCur->color.g = g / 255.0f * SCALE_G;
-			pCur->color.b = b / 255.0f * SCALE_B;
-			pCur->color.a = a / 255.0f * SCALE_A;
+			pCur->color.r *= pCur->color.a;
+			pCur->color.g *= pCur->color.a;
+			pCur->color.b *= pCur->color.a;
+		}
 
-			if(pExq->transparency)
-			{
-				pCur->color.r *= pCur->color.a;
-				pCur->color.g *= pCur->color.a;
-				pCur->color.b *= pCur->color.a;
-			}
+		pCur->num = num;
+		pCur->pDither->palIndex = -1;
+		pCur->pDither->ditherScale.r = pCur->pDither->ditherScale.g =
+			pCur->pDither->ditherScale.b = pCur->pDither->ditherScale.a = -1;
+		pCur->pDither->ditherIndex[0] = pCur->pDither->ditherIndex[1] =
+			pCur->pDither->ditherIndex[2] = pCur->pDither->ditherIndex[3] = -1;
+	}
+}
 
-			pCur->num = 1;
-			pCur->palIndex = -1;
-			pCur->ditherScale.r = pCur->ditherScale.g = pCur->ditherScale.b =
-				pCur->ditherScale.a = -1;
-			pCur->ditherIndex[0] = pCur->ditherIndex[1] = pCur->ditherIndex[2] =
-				pCur->ditherIndex[3] = -1;
-		}
+void exq_feed(exq_data *pExq, unsigned char *pData, int nPixels)
+{
+	int i;
+
+	for(i = 0; i < nPixels; i++, pData += 4)
+		exq_add_color(pExq, pData[0], pData[1], pData[2], pData[3], 1);
+}
+
+exq_partial *exq_partial_init(int nPixels)
+{
+	exq_partial *pPart;
+	unsigned int tableSize = 16;
+	int tableShift = 28;
+
+	while(tableSize < (unsigned int)nPixels * 2)
+	{
+		tableSize *= 2;
+		tableShift--;
+	}
+
+	pPart = (exq_partial*)malloc(sizeof(exq_partial));
+	pPart->pTable = (unsigned int*)calloc(tableSize, sizeof(unsigned int));
+	pPart->pColors = (unsigned int*)malloc((nPixels > 0 ? nPixels : 1) * sizeof(unsigned int));
+	pPart->pCounts = (int*)malloc((nPixels > 0 ? nPixels : 1) * sizeof(int));
+	pPart->tableMask = tableSize - 1;
+	pPart->tableShift = tableShift;
+	pPart->numEntries = 0;
+	return pPart;
+}
+
+/* table slots hold entry index + 1 so zeroed slots are empty */
+static void exq_partial_add(exq_partial *pPart, unsigned int rgba, int num)
+{
+	unsigned int slot, entry;
+
+	slot = (rgba * 0x9E3779B1u) >> pPart->tableShift;
+	while((entry = pPart->pTable[slot]) != 0 && pPart->pColors[entry - 1] != rgba)
+		slot = (slot + 1) & pPart->tableMask;
+
+	if(entry != 0)
+		pPart->pCounts[entry - 1] += num;
+	else
+	{
+		pPart->pColors[pPart->numEntries] = rgba;
+		pPart->pCounts[pPart->numEntries] = num;
+		pPart->numEntries++;
+		pPart->pTable[slot] = pPart->numEntries;
+	}
+}
+
+void exq_partial_feed(exq_partial *pPart, unsigned char *pData, int nPixels)
+{
+	int i;
+
+	for(i = 0; i < nPixels; i++, pData += 4)
+		exq_partial_add(pPart, ((unsigned int)pData[0]) | (((unsigned int)pData[1]) << 8) |
+			(((unsigned int)pData[2]) << 16) | (((unsigned int)pData[3]) << 24), 1);
+}
+
+exq_partial *exq_partial_merge(exq_partial *pFirst, exq_partial *pSecond)
+{
+	int j;
+	exq_partial *pPart;
+
+	pPart = exq_partial_init(pFirst->numEntries + pSecond->numEntries);
+	for(j = 0; j < pFirst->numEntries; j++)
+		exq_partial_add(pPart, pFirst->pColors[j], pFirst->pCounts[j]);
+	for(j = 0; j < pSecond->numEntries; j++)
+		exq_partial_add(pPart, pSecond->pColors[j], pSecond->pCounts[j]);
+
+	return pPart;
+}
+
+void exq_feed_partials(exq_data *pExq, exq_partial **ppParts, int nParts)
+{
+	int i, j, total;
+	unsigned int rgba;
+	exq_partial *pAll;
+
+	/* merge the bands first so every color only goes into the hash once */
+	if(nParts == 1)
+		pAll = ppParts[0];
+	else
+	{
+		total = 0;
+		for(i = 0; i < nParts; i++)
+			total += ppParts[i]->numEntries;
+
+		pAll = exq_partial_init(total);
+		for(i = 0; i < nParts; i++)
+			for(j = 0; j < ppParts[i]->numEntries; j++)
+				exq_partial_add(pAll, ppParts[i]->pColors[j], ppParts[i]->pCounts[j]);
+	}
+
+	for(i = 0; i < pAll->numEntries; i++)
+	{
+		rgba = pAll->pColors[i];
+		exq_add_color(pExq, rgba & 0xFF, (rgba >> 8) & 0xFF, (rgba >> 16) & 0xFF,
+			rgba >> 24, pAll->pCounts[i]);
 	}
+
+	if(pAll != ppParts[0])
+		exq_partial_free(pAll);
+}
+
+void exq_partial_free(exq_partial *pPart)
+{
+	free(pPart->pTable);
+	free(pPart->pColors);
+	free(pPart->pCounts);
+	free(pPart);
 }
 
 void exq_quantize(exq_data *pExq, int nColors)
@@ -149,7 +307,7 @@ void exq_quantize_ex(exq_data *pExq, int nColors, int hq)
 {
 	int besti;
 	exq_float beste;
-	exq_histogram *pCur, *pNext;
+	exq_node *pNode, *pNew;
 	int i, j;
 
 	if(nColors > 256)
@@ -157,15 +315,15 @@ void exq_quantize_ex(exq_data *pExq, int nColors, int hq)
 
 	if(pExq->numColors == 0)
 	{
-		pExq->node[0].pHistogram = NULL;
-		for(i = 0; i < EXQ_HASH_SIZE; i++)
-			for(pCur = pExq->pHash[i]; pCur != NULL; pCur = pCur->pNextInHash)
-			{
-				pCur->pNext = pExq->node[0].pHistogram;
-				pExq->node[0].pHistogram = pCur;
-			}
-		
-		exq_sum_node(&pExq->node[0]);
+		exq_alloc_members(pExq);
+		pExq->nearestValid = 0;
+		for(i = 0; i < pExq->numHistograms; i++)
+			pExq->ppMembers[i] = pExq->ppEntries[pExq->numHistograms - 1 - i];
+
+		pExq->node[0].firstMember = 0;
+		pExq->node[0].numMembers = pExq->numHistograms;
+		pExq->node[0].stale = 1;
+		exq_sum_node(pExq, &pExq->node[0]);
 
 		pExq->numColors = 1;
 	}
@@ -183,27 +341,21 @@ void exq_quantize_ex(exq_data *pExq, int nColors, int hq)
 
 //		printf("node %d: %d, %f\n", besti, pExq->node[besti].num, beste);
 
-		pCur = pExq->node[besti].pHistogram;
-		pExq->node[besti].pHistogram = NULL;
-		pExq->node[i].pHistogram = NULL;
-		while(pCur != NULL && pCur != pExq->node[besti].pSplit)
-		{
-			pNext = pCur->pNext;
-			pCur->pNext = pExq->node[i].pHistogram;
-			pExq->node[i].pHistogram = pCur;
-			pCur = pNext;
-		}
-
-		while(pCur != NULL)
-		{
-			pNext = pCur->pNext;
-			pCur->pNext = pExq->node[besti].pHistogram;
-			pExq->node[besti].pHistogram = pCur;
-			pCur = pNext;
-		}
-
-		exq_sum_node(&pExq->node[besti]);
-		exq_sum_node(&pExq->node[i]);
+		/* both halves keep their place in ppMembers but are reversed, */
+		/* exq_sort depends on the order it is given */
+		pNode = &pExq->node[besti];
+		pNew = &pExq->node[i];
+		pNew->firstMember = pNode->firstMember;
+		pNew->numMembers = pNode->split;
+		pNode->firstMember += pNode->split;
+		pNode->numMembers -= pNode->split;
+		exq_reverse_members(&pExq->ppMembers[pNew->firstMember], pNew->numMembers);
+		exq_reverse_members(&pExq->ppMembers[pNode->firstMember], pNode->numMembers);
+		pNode->stale = 1;
+		pNew->stale = 1;
+
+		exq_sum_node(pExq, pNode);
+		exq_sum_node(pExq, pNew);
 
 		pExq->numColors = i + 1;
 		if(hq)
@@ -278,22 +430,31 @@ void exq_set_palette(exq_data *pExq, unsigned char *pPal, int nColors)
 		pExq->node[i].avg.a = *pPal++ * SCALE_A / 255.9f;
 	}
 
+	pExq->nearestValid = 0;
+
 	pExq->optimized = 1;
 }
 
-void exq_sum_node(exq_node *pNode)
+void exq_sum_node(exq_data *pExq, exq_node *pNode)
 {
-	int n, n2;
+	int i, n, n2, nHist;
 	exq_color fsum, fsum2, vc, tmp, tmp2, sum, sum2;
-	exq_histogram *pCur;
+	exq_histogram **ppHist, *pCur;
+	exq_sort_item *pItems;
 	exq_float isqrt, nv, v;
 
+	ppHist = &pExq->ppMembers[pNode->firstMember];
+	nHist = pNode->numMembers;
+	pItems = pExq->pSortItems;
+	pNode->moved = 1;
+
 	n = 0;
 	fsum.r = fsum.g = fsum.b = fsum.a = 0;
 	fsum2.r = fsum2.g = fsum2.b = fsum2.a = 0;
 
-	for(pCur = pNode->pHistogram; pCur != NULL; pCur = pCur->pNext)
+	for(i = 0; i < nHist; i++)
 	{
+		pCur = ppHist[i];
 		n += pCur->num;
 		fsum.r += pCur->color.r * pCur->num;
 		fsum.g += pCur->color.g * pCur->num;
@@ -309,6 +470,7 @@ void exq_sum_node(exq_node *pNode)
 	{
 		pNode->vdif = 0;
 		pNode->err = 0;
+		pNode->split = 0;
 		return;
 	}
 
@@ -326,18 +488,35 @@ void exq_sum_node(exq_node *pNode)
 	pNode->err = v;
 	pNode->vdif = -v;
 
+	for(i = 0; i < nHist; i++)
+		pItems[i].pHist = ppHist[i];
+
 	if(vc.r > vc.g && vc.r > vc.b && vc.r > vc.a)
-		exq_sort(&pNode->pHistogram, exq_sort_by_r);
+	{
+		for(i = 0; i < nHist; i++)
+			pItems[i].key = pItems[i].pHist->color.r;
+	}
 	else if(vc.g > vc.b && vc.g > vc.a)
-		exq_sort(&pNode->pHistogram, exq_sort_by_g);
+	{
+		for(i = 0; i < nHist; i++)
+			pItems[i].key = pItems[i].pHist->color.g;
+	}
 	else if(vc.b > vc.a)
-		exq_sort(&pNode->pHistogram, exq_sort_by_b);
+	{
+		for(i = 0; i < nHist; i++)
+			pItems[i].key = pItems[i].pHist->color.b;
+	}
 	else
-		exq_sort(&pNode->pHistogram, exq_sort_by_a);
+	{
+		for(i = 0; i < nHist; i++)
+			pItems[i].key = pItems[i].pHist->color.a;
+	}
+	exq_sort(pItems, pExq->pSortTemp, nHist);
 
 	pNode->dir.r = pNode->dir.g = pNode->dir.b = pNode->dir.a = 0;
-	for(pCur = pNode->pHistogram; pCur != NULL; pCur = pCur->pNext)
+	for(i = 0; i < nHist; i++)
 	{
+		pCur = pItems[i].pHist;
 		tmp.r = (pCur->color.r - pNode->avg.r) * pCur->num;
 		tmp.g = (pCur->color.g - pNode->avg.g) * pCur->num;
 		tmp.b = (pCur->color.b - pNode->avg.b) * pCur->num;
@@ -363,18 +542,26 @@ void exq_sum_node(exq_node *pNode)
 	pNode->dir.b *= isqrt;
 	pNode->dir.a *= isqrt;
 
-	exq_sort_dir = pNode->dir;
-	exq_sort(&pNode->pHistogram, exq_sort_by_dir);
+	for(i = 0; i < nHist; i++)
+	{
+		pCur = pItems[i].pHist;
+		pItems[i].key = pCur->color.r * pNode->dir.r +
+			pCur->color.g * pNode->dir.g +
+			pCur->color.b * pNode->dir.b +
+			pCur->color.a * pNode->dir.a;
+	}
+	exq_sort(pItems, pExq->pSortTemp, nHist);
+
+	for(i = 0; i < nHist; i++)
+		ppHist[i] = pItems[i].pHist;
 
 	sum.r = sum.g = sum.b = sum.a = 0;
 	sum2.r = sum2.g = sum2.b = sum2.a = 0;
 	n2 = 0;
-	pNode->pSplit = pNode->pHistogram;
-	for(pCur = pNode->pHistogram; pCur != NULL; pCur = pCur->pNext)
+	pNode->split = 1;
+	for(i = 0; i < nHist; i++)
 	{
-		if(pNode->pSplit == NULL)
-			pNode->pSplit = pCur;
-
+		pCur = ppHist[i];
 		n2 += pCur->num;
 		sum.r += pCur->color.r * pCur->num;
 		sum.g += pCur->color.g * pCur->num;
@@ -401,39 +588,108 @@ void exq_sum_node(exq_node *pNode)
 		if(-nv > pNode->vdif)
 		{
 			pNode->vdif = -nv;
-			pNode->pSplit = NULL;
+			pNode->split = i + 1;
 		}
 	}
 
-	if(pNode->pSplit == pNode->pHistogram)
-		pNode->pSplit = pNode->pSplit->pNext;
-
 	pNode->vdif += v;
 //	printf("error sum: %f, vdif: %f\n", pNode->err, pNode->vdif);
 }
 
 void exq_optimize_palette(exq_data *pExq, int iter)
 {
-	int n, i, j;
-	exq_histogram *pCur;
+	int n, i, j, k, c, numMoved;
+	int first[256];
+	unsigned char moved[256];
+	exq_color dif;
+	exq_histogram *pCur, **ppTmp;
+	exq_node *pNode;
 
 	pExq->optimized = 1;
+	exq_alloc_members(pExq);
 
 	for(n = 0; n < iter; n++)
 	{
+		exq_prepare_nearest(pExq);
+		numMoved = 0;
 		for(i = 0; i < pExq->numColors; i++)
-			pExq->node[i].pHistogram = NULL;
+		{
+			if(pExq->node[i].moved)
+				moved[numMoved++] = (unsigned char)i;
+			if(!pExq->nearestValid)
+				pExq->node[i].stale = 1;
+			first[i] = 0;
+		}
+		exq_fill_nearest(&pExq->movedNearest, pExq, moved, numMoved);
 
-		for(i = 0; i < EXQ_HASH_SIZE; i++)
-			for(pCur = pExq->pHash[i]; pCur != NULL; pCur = pCur->pNextInHash)
+		/* an entry can only leave a node that did not move for one that */
+		/* did, so only those need searching starting from the old match */
+		for(k = 0; k < pExq->numHistograms; k++)
+		{
+			pCur = pExq->ppEntries[k];
+			if(pExq->nearestValid)
 			{
-				j = exq_find_nearest_color(pExq, &pCur->color);
-				pCur->pNext = pExq->node[j].pHistogram;
-				pExq->node[j].pHistogram = pCur;
+				c = pExq->pNearestNode[k];
+				if(!pExq->node[c].moved)
+				{
+					dif.r = pCur->color.r - pExq->node[c].avg.r;
+					dif.g = pCur->color.g - pExq->node[c].avg.g;
+					dif.b = pCur->color.b - pExq->node[c].avg.b;
+					dif.a = pCur->color.a - pExq->node[c].avg.a;
+					j = exq_search_nearest(&pExq->movedNearest, &pCur->color,
+						dif.r*dif.r + dif.g*dif.g + dif.b*dif.b + dif.a*dif.a, c);
+				}
+				else
+					j = exq_find_nearest_color(pExq, &pCur->color);
+				if(j != c)
+				{
+					pExq->node[c].stale = 1;
+					pExq->node[j].stale = 1;
+				}
 			}
+			else
+				j = exq_find_nearest_color(pExq, &pCur->color);
+
+			pExq->pNearestNode[k] = (unsigned char)j;
+			first[j]++;
+		}
+		pExq->nearestValid = 1;
 
+		/* nodes that kept their members keep their sorted order too */
+		j = 0;
 		for(i = 0; i < pExq->numColors; i++)
-			exq_sum_node(&pExq->node[i]);
+		{
+			pNode = &pExq->node[i];
+			c = first[i];
+			first[i] = j;
+			if(!pNode->stale)
+				memcpy(&pExq->ppMembersTemp[j], &pExq->ppMembers[pNode->firstMember],
+					sizeof(exq_histogram*) * c);
+			pNode->firstMember = j;
+			pNode->numMembers = c;
+			pNode->moved = 0;
+			j += c;
+		}
+
+		/* walked backwards so every node gets its entries in the */
+		/* reverse of hash order, like the initial node */
+		while(k-- > 0)
+		{
+			j = pExq->pNearestNode[k];
+			if(pExq->node[j].stale)
+				pExq->ppMembersTemp[first[j]++] = pExq->ppEntries[k];
+		}
+
+		ppTmp = pExq->ppMembers;
+		pExq->ppMembers = pExq->ppMembersTemp;
+		pExq->ppMembersTemp = ppTmp;
+
+		for(i = 0; i < pExq->numColors; i++)
+			if(pExq->node[i].stale)
+			{
+				exq_sum_node(pExq, &pExq->node[i]);
+				pExq->node[i].stale = 0;
+			}
 	}
 }
 
@@ -446,13 +702,14 @@ void exq_map_image(exq_data *pExq, int nPixels, unsigned char *pIn,
 
 	if(!pExq->optimized)
 		exq_optimize_palette(pExq, 4);
+	exq_prepare_nearest(pExq);
 
 	for(i = 0; i < nPixels; i++)
 	{
 		pHist = exq_find_histogram(pExq, pIn);
-		if(pHist != NULL && pHist->palIndex != -1)
+		if(pHist != NULL && pHist->pDither->palIndex != -1)
 		{
-			*pOut++ = (unsigned char)pHist->palIndex;
+			*pOut++ = (unsigned char)pHist->pDither->palIndex;
 			pIn += 4;
 		}
 		else
@@ -469,7 +726,7 @@ void exq_map_image(exq_data *pExq, int nPixels, unsigned char *pIn,
 
 			*pOut = exq_find_nearest_color(pExq, &c);
 			if(pHist != NULL)
-				pHist->palIndex = *pOut;
+				pHist->pDither->palIndex = *pOut;
 			pOut++;
 		}
 	}
@@ -497,6 +754,7 @@ void exq_map_image_dither(exq_data *pExq, int width, int height,
 
 	if(!pExq->optimized)
 		exq_optimize_palette(pExq, 4);
+	exq_prepare_nearest(pExq);
 
 	for(y = 0; y < height; y++)
 		for(x = 0; x < width; x++)
@@ -516,7 +774,7 @@ void exq_map_image_dither(exq_data *pExq, int width, int height,
 				p.r *= p.a; p.g *= p.a; p.b *= p.a;
 			}
 
-			if(pHist == NULL || pHist->ditherScale.r < 0)
+			if(pHist == NULL || pHist->pDither->ditherScale.r < 0)
 			{
 				i = exq_find_nearest_color(pExq, &p);
 				scale.r = pExq->node[i].avg.r - p.r;
@@ -552,22 +810,22 @@ void exq_map_image_dither(exq_data *pExq, int width, int height,
 
 				if(pHist != NULL)
 				{
-					pHist->ditherScale.r = scale.r;
-					pHist->ditherScale.g = scale.g;
-					pHist->ditherScale.b = scale.b;
-					pHist->ditherScale.a = scale.a;
+					pHist->pDither->ditherScale.r = scale.r;
+					pHist->pDither->ditherScale.g = scale.g;
+					pHist->pDither->ditherScale.b = scale.b;
+					pHist->pDither->ditherScale.a = scale.a;
 				}
 			}
 			else
 			{
-				scale.r = pHist->ditherScale.r;
-				scale.g = pHist->ditherScale.g;
-				scale.b = pHist->ditherScale.b;
-				scale.a = pHist->ditherScale.a;
+				scale.r = pHist->pDither->ditherScale.r;
+				scale.g = pHist->pDither->ditherScale.g;
+				scale.b = pHist->pDither->ditherScale.b;
+				scale.a = pHist->pDither->ditherScale.a;
 			}
 
-			if(pHist != NULL && pHist->ditherIndex[d] >= 0)
-				*pOut++ = (unsigned char)pHist->ditherIndex[d];
+			if(pHist != NULL && pHist->pDither->ditherIndex[d] >= 0)
+				*pOut++ = (unsigned char)pHist->pDither->ditherIndex[d];
 			else
 			{
 				tmp.r = p.r + scale.r * dither_matrix[d];
@@ -576,7 +834,7 @@ void exq_map_image_dither(exq_data *pExq, int width, int height,
 				tmp.a = p.a + scale.a * dither_matrix[d];
 				*pOut = exq_find_nearest_color(pExq, &tmp);
 				if(pHist != NULL)
-					pHist->ditherIndex[d] = *pOut;
+					pHist->pDither->ditherIndex[d] = *pOut;
 				pOut++;
 			}
 		}
@@ -599,110 +857,262 @@ exq_histogram *exq_find_histogram(exq_data *pExq, unsigned char *pCol)
 	return pCur;
 }
 
-unsigned char exq_find_nearest_color(exq_data *pExq, exq_color *pColor)
+void exq_prepare_nearest(exq_data *pExq)
 {
-	exq_float bestv;
-	int besti, i;
-	exq_color dif;
+	exq_fill_nearest(&pExq->nearest, pExq, NULL, pExq->numColors);
+}
 
-	bestv = 16;
-	besti = 0;
-	for(i = 0; i < pExq->numColors; i++)
+/* pIndex lists the nodes to take, NULL takes the first num */
+void exq_fill_nearest(exq_nearest *pNear, exq_data *pExq, const unsigned char *pIndex,
+					  int num)
+{
+	exq_float min[4], max[4], range, bestRange;
+	exq_float *pAxis[4];
+	int i, j, axis;
+	unsigned char idx;
+
+	pNear->num = num;
+	for(i = 0; i < pNear->num; i++)
 	{
-		dif.r = pColor->r - pExq->node[i].avg.r;
-		dif.g = pColor->g - pExq->node[i].avg.g;
-		dif.b = pColor->b - pExq->node[i].avg.b;
-		dif.a = pColor->a - pExq->node[i].avg.a;
-		if(dif.r*dif.r + dif.g*dif.g + dif.b*dif.b + dif.a*dif.a < bestv)
+		idx = pIndex != NULL ? pIndex[i] : (unsigned char)i;
+		pNear->r[i] = pExq->node[idx].avg.r;
+		pNear->g[i] = pExq->node[idx].avg.g;
+		pNear->b[i] = pExq->node[idx].avg.b;
+		pNear->a[i] = pExq->node[idx].avg.a;
+		pNear->index[i] = idx;
+	}
+
+	pAxis[0] = pNear->r; pAxis[1] = pNear->g;
+	pAxis[2] = pNear->b; pAxis[3] = pNear->a;
+	axis = 0;
+	bestRange = -1;
+	for(j = 0; j < 4; j++)
+	{
+		min[j] = max[j] = pNear->num > 0 ? pAxis[j][0] : 0;
+		for(i = 1; i < pNear->num; i++)
+		{
+			if(pAxis[j][i] < min[j]) min[j] = pAxis[j][i];
+			if(pAxis[j][i] > max[j]) max[j] = pAxis[j][i];
+		}
+		range = max[j] - min[j];
+		if(range > bestRange)
 		{
-			bestv = dif.r*dif.r + dif.g*dif.g + dif.b*dif.b + dif.a*dif.a;
-			besti = i;
+			bestRange = range;
+			axis = j;
 		}
 	}
+	pNear->pKey = pAxis[axis];
 
-	return (unsigned char)besti;
+	/* insertion sort, at most 256 entries */
+	for(i = 1; i < pNear->num; i++)
+	{
+		exq_float r = pNear->r[i], g = pNear->g[i], b = pNear->b[i], a = pNear->a[i];
+		exq_float key = pNear->pKey[i];
+		idx = pNear->index[i];
+		for(j = i; j > 0 && pNear->pKey[j - 1] > key; j--)
+		{
+			pNear->r[j] = pNear->r[j - 1];
+			pNear->g[j] = pNear->g[j - 1];
+			pNear->b[j] = pNear->b[j - 1];
+			pNear->a[j] = pNear->a[j - 1];
+			pNear->index[j] = pNear->index[j - 1];
+		}
+		pNear->r[j] = r; pNear->g[j] = g;
+		pNear->b[j] = b; pNear->a[j] = a;
+		pNear->index[j] = idx;
+	}
 }
 
-void exq_sort(exq_histogram **ppHist, exq_float (*sortfunc)(const exq_histogram *pHist))
+/* the distance is summed in the same order as a plain linear scan and ties */
+/* go to the lowest palette index, so the result matches one bit for bit */
+static void exq_test_nearest(const exq_nearest *pNear, const exq_color *pColor,
+							 int i, exq_float *pBestv, int *pBesti)
 {
-	exq_histogram *pLow, *pHigh, *pCur, *pNext;
-	int n = 0;
-	exq_float sum = 0;
+	exq_color dif;
+	exq_float v;
 
-	for(pCur = *ppHist; pCur != NULL; pCur = pCur->pNext)
+	dif.r = pColor->r - pNear->r[i];
+	dif.g = pColor->g - pNear->g[i];
+	v = dif.r*dif.r + dif.g*dif.g;
+	if(v > *pBestv)
+		return;
+	dif.b = pColor->b - pNear->b[i];
+	dif.a = pColor->a - pNear->a[i];
+	v = v + dif.b*dif.b + dif.a*dif.a;
+	if(v < *pBestv || (v == *pBestv && pNear->index[i] < *pBesti))
 	{
-		n++;
-		sum += sortfunc(pCur);
+		*pBestv = v;
+		*pBesti = pNear->index[i];
 	}
+}
 
-	if(n < 2)
-		return;
+/* needs exq_prepare_nearest after every palette change */
+unsigned char exq_find_nearest_color(exq_data *pExq, exq_color *pColor)
+{
+	return (unsigned char)exq_search_nearest(&pExq->nearest, pColor, 16, 0);
+}
 
-	sum /= n;
+/* nearest entry of pNear that is closer than bestv, or besti if none is */
+int exq_search_nearest(const exq_nearest *pNear, const exq_color *pColor,
+					   exq_float bestv, int besti)
+{
+	exq_float key, dif;
+	int lo, hi, mid, up, down;
+
+	/* start at the first entry not below the color along the sort axis */
+	key = pNear->pKey == pNear->r ? pColor->r : pNear->pKey == pNear->g ? pColor->g :
+		pNear->pKey == pNear->b ? pColor->b : pColor->a;
+	lo = 0;
+	hi = pNear->num;
+	while(lo < hi)
+	{
+		mid = (lo + hi) / 2;
+		if(pNear->pKey[mid] < key)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
 
-	pLow = pHigh = NULL;
-	for(pCur = *ppHist; pCur != NULL; pCur = pNext)
+	/* walk outwards until the axis distance alone exceeds the best match */
+	up = lo;
+	down = lo - 1;
+	while(up < pNear->num || down >= 0)
 	{
-		pNext = pCur->pNext;
-		if(sortfunc(pCur) < sum)
+		if(up < pNear->num)
 		{
-			pCur->pNext = pLow;
-			pLow = pCur;
+			dif = pNear->pKey[up] - key;
+			if(dif*dif > bestv)
+				up = pNear->num;
+			else
+				exq_test_nearest(pNear, pColor, up++, &bestv, &besti);
 		}
-		else
+		if(down >= 0)
 		{
-			pCur->pNext = pHigh;
-			pHigh = pCur;
+			dif = key - pNear->pKey[down];
+			if(dif*dif > bestv)
+				down = -1;
+			else
+				exq_test_nearest(pNear, pColor, down--, &bestv, &besti);
 		}
 	}
 
-	if(pLow == NULL)
-	{
-		*ppHist = pHigh;
-		return;
-	}
-	if(pHigh == NULL)
-	{
-		*ppHist = pLow;
-		return;
-	}
+	return besti;
+}
 
-	exq_sort(&pLow, sortfunc);
-	exq_sort(&pHigh, sortfunc);
+void exq_alloc_members(exq_data *pExq)
+{
+	int i, n = pExq->numHistograms + 1;
+	exq_histogram *pCur;
 
-	*ppHist = pLow;
-	while(pLow->pNext != NULL)
-		pLow = pLow->pNext;
+	if(pExq->ppMembers != NULL && pExq->numAllocated == pExq->numHistograms)
+		return;
 
-	pLow->pNext = pHigh;
-}
+	pExq->ppMembers = (exq_histogram**)realloc(pExq->ppMembers, sizeof(exq_histogram*) * n);
+	pExq->ppMembersTemp = (exq_histogram**)realloc(pExq->ppMembersTemp, sizeof(exq_histogram*) * n);
+	pExq->ppEntries = (exq_histogram**)realloc(pExq->ppEntries, sizeof(exq_histogram*) * n);
+	pExq->pSortItems = (exq_sort_item*)realloc(pExq->pSortItems, sizeof(exq_sort_item) * n);
+	pExq->pSortTemp = (exq_sort_item*)realloc(pExq->pSortTemp, sizeof(exq_sort_item) * n);
+	pExq->pNearestNode = (unsigned char*)realloc(pExq->pNearestNode, n);
+	pExq->numAllocated = pExq->numHistograms;
+	pExq->nearestValid = 0;
 
-exq_float exq_sort_by_r(const exq_histogram *pHist)
-{
-	return pHist->color.r;
+	n = 0;
+	for(i = 0; i < EXQ_HASH_SIZE; i++)
+		for(pCur = pExq->pHash[i]; pCur != NULL; pCur = pCur->pNextInHash)
+			pExq->ppEntries[n++] = pCur;
 }
 
-exq_float exq_sort_by_g(const exq_histogram *pHist)
+void exq_reverse_members(exq_histogram **ppHist, int n)
 {
-	return pHist->color.g;
-}
+	int i;
+	exq_histogram *pTmp;
 
-exq_float exq_sort_by_b(const exq_histogram *pHist)
-{
-	return pHist->color.b;
+	for(i = 0; i < n / 2; i++)
+	{
+		pTmp = ppHist[i];
+		ppHist[i] = ppHist[n - 1 - i];
+		ppHist[n - 1 - i] = pTmp;
+	}
 }
 
-exq_float exq_sort_by_a(const exq_histogram *pHist)
+/* the items of pIn are taken back to front when rev is set, pOther is the */
+/* same range of the other buffer and pOut is whichever of them is pItems */
+static void exq_sort_range(exq_sort_item *pIn, exq_sort_item *pOther,
+						   exq_sort_item *pOut, int n, int rev)
 {
-	return pHist->color.a;
-}
+	int i, nLow, nHigh;
+	exq_float sum = 0;
+	exq_sort_item tmp;
+
+	if(n < 2)
+	{
+		if(n == 1 && pIn != pOut)
+			pOut[0] = pIn[0];
+		return;
+	}
+
+	if(rev)
+		for(i = n - 1; i >= 0; i--)
+			sum += pIn[i].key;
+	else
+		for(i = 0; i < n; i++)
+			sum += pIn[i].key;
+
+	sum /= n;
+
+	/* splits around the mean into the other buffer, the low side in */
+	/* order at the front and the high side reversed at the back, both */
+	/* sides then read backwards give the order the old linked list */
+	/* version left them in */
+	nLow = 0;
+	nHigh = n;
+	if(rev)
+	{
+		for(i = n - 1; i >= 0; i--)
+			if(pIn[i].key < sum)
+				pOther[nLow++] = pIn[i];
+			else
+				pOther[--nHigh] = pIn[i];
+	}
+	else
+	{
+		for(i = 0; i < n; i++)
+			if(pIn[i].key < sum)
+				pOther[nLow++] = pIn[i];
+			else
+				pOther[--nHigh] = pIn[i];
+	}
+
+	if(nLow == 0)
+	{
+		if(pOther != pOut)
+			memcpy(pOut, pOther, sizeof(exq_sort_item) * n);
+		return;
+	}
+	if(nLow == n)
+	{
+		if(pOther != pOut)
+		{
+			for(i = 0; i < n; i++)
+				pOut[i] = pOther[n - 1 - i];
+		}
+		else
+		{
+			for(i = 0; i < n / 2; i++)
+			{
+				tmp = pOut[i];
+				pOut[i] = pOut[n - 1 - i];
+				pOut[n - 1 - i] = tmp;
+			}
+		}
+		return;
+	}
 
-exq_color exq_sort_dir;
+	exq_sort_range(pOther, pIn, pOut, nLow, 1);
+	exq_sort_range(pOther + nLow, pIn + nLow, pOut + nLow, n - nLow, 0);
+}
 
-exq_float exq_sort_by_dir(const exq_histogram *pHist)
+void exq_sort(exq_sort_item *pItems, exq_sort_item *pTemp, int n)
 {
-	return pHist->color.r * exq_sort_dir.r +
-		pHist->color.g * exq_sort_dir.g +
-		pHist->color.b * exq_sort_dir.b +
-		pHist->color.a * exq_sort_dir.a;
+	exq_sort_range(pItems, pTemp, pItems, n, 0);
 }
\ No newline at end of file
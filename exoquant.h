@@ -46,6 +46,9 @@ SOFTWARE.
 * change the SCALE_x constants in expquant.h, as those are the only differences
 * between the channels.
 *
+* All state lives in exq_data, so separate instances can be used from
+* different threads at the same time.
+*
 ******************************************************************************/
 
 #ifndef __EXOQUANT_H
@@ -63,28 +66,83 @@ typedef struct _exq_color
 	exq_float r, g, b, a;
 } exq_color;
 
+/* mapping cache, only touched by exq_map_image* */
+typedef struct _exq_dither
+{
+	exq_color				ditherScale;
+	short					palIndex;
+	short					ditherIndex[4];
+} exq_dither;
+
+/* fields used while quantizing come first and fit in one 64 byte cache line */
 typedef struct _exq_histogram
 {
 	exq_color				color;
-	unsigned char			ored, ogreen, oblue, oalpha;
-	int						palIndex;
-	exq_color				ditherScale;
-	int						ditherIndex[4];
 	int						num;
-	struct _exq_histogram	*pNext;
+	unsigned char			ored, ogreen, oblue, oalpha;
 	struct _exq_histogram	*pNextInHash;
+	exq_dither				*pDither;
 } exq_histogram;
 
+#define EXQ_BLOCK_MIN_SIZE		64
+#define EXQ_BLOCK_SIZE			4096
+
+/* histogram entries are carved out of blocks that are freed all at once,
+   blocks double from EXQ_BLOCK_MIN_SIZE up to EXQ_BLOCK_SIZE entries so
+   images with few colors stay small */
+typedef struct _exq_block
+{
+	struct _exq_block		*pPrev;
+	int						numUsed;
+	int						numAllocated;
+	exq_histogram			*hist;
+	exq_dither				*dither;
+} exq_block;
+
 typedef struct _exq_node
 {
 	exq_color				dir, avg;
 	exq_float					vdif;
 	exq_float					err;
 	int						num;
-	exq_histogram			*pHistogram;
-	exq_histogram			*pSplit;
+	/* members are ppMembers[firstMember] onwards in exq_data, the ones */
+	/* before split go to the new node when this node is split */
+	int						firstMember;
+	int						numMembers;
+	int						split;
+	/* members are not in the order exq_optimize_palette would give them */
+	int						stale;
+	/* avg may have changed since the nearest nodes were last found */
+	int						moved;
 } exq_node;
 
+/* histogram entry with the key exq_sort orders it by */
+typedef struct _exq_sort_item
+{
+	exq_float				key;
+	exq_histogram			*pHist;
+} exq_sort_item;
+
+/* colors of one band of pixels with their counts in order of first appearance */
+typedef struct _exq_partial
+{
+	unsigned int			*pTable;
+	unsigned int			*pColors;
+	int						*pCounts;
+	int						numEntries;
+	unsigned int			tableMask;
+	int						tableShift;
+} exq_partial;
+
+/* palette as arrays sorted along its widest channel for exq_find_nearest_color */
+typedef struct _exq_nearest
+{
+	exq_float				r[256], g[256], b[256], a[256];
+	unsigned char			index[256];
+	exq_float				*pKey;
+	int						num;
+} exq_nearest;
+
 #define EXQ_HASH_BITS			16
 #define EXQ_HASH_SIZE			(1 << (EXQ_HASH_BITS))
 
@@ -92,6 +150,20 @@ typedef struct _exq_data
 {
 	exq_histogram			*pHash[EXQ_HASH_SIZE];
 	exq_node				node[256];
+	exq_block				*pBlocks;
+	int						numHistograms;
+	int						numAllocated;
+	exq_histogram			**ppMembers, **ppMembersTemp;
+	/* every histogram entry in hash order */
+	exq_histogram			**ppEntries;
+	exq_sort_item			*pSortItems, *pSortTemp;
+	/* nearest node of every histogram entry in hash order, kept between */
+	/* exq_optimize_palette passes while nearestValid is set */
+	unsigned char			*pNearestNode;
+	int						nearestValid;
+	exq_nearest				nearest;
+	/* nodes that moved since the last exq_optimize_palette pass */
+	exq_nearest				movedNearest;
 	int						numColors;
 	int						numBitsPerChannel;
 	int						optimized;
@@ -105,6 +177,18 @@ void				exq_no_transparency(exq_data *pExq);
 void				exq_free(exq_data *pExq);
 void				exq_feed(exq_data *pExq, unsigned char *pData,
 							 int nPixels);
+/* exq_feed split into bands that can be counted on separate threads, */
+/* feeding the partials of consecutive bands together in order gives the */
+/* same histogram as one exq_feed over all of them */
+exq_partial			*exq_partial_init(int nPixels);
+void				exq_partial_feed(exq_partial *pPart, unsigned char *pData,
+									 int nPixels);
+/* partial of two consecutive bands, merging neighbours in parallel rounds */
+/* builds the same single partial exq_feed_partials would */
+exq_partial			*exq_partial_merge(exq_partial *pFirst, exq_partial *pSecond);
+void				exq_feed_partials(exq_data *pExq, exq_partial **ppParts,
+									  int nParts);
+void				exq_partial_free(exq_partial *pPart);
 void				exq_quantize(exq_data *pExq, int nColors);
 void				exq_quantize_hq(exq_data *pExq, int nColors);
 void				exq_quantize_ex(exq_data *pExq, int nColors, int hq);
@@ -127,21 +211,21 @@ void				exq_map_image_dither(exq_data *pExq, int width,
 										 int height, unsigned char *pIn,
 										 unsigned char *pOut, int ordered);
 
-void				exq_sum_node(exq_node *pNode);
+void				exq_sum_node(exq_data *pExq, exq_node *pNode);
 void				exq_optimize_palette(exq_data *pExp, int iter);
 
+void				exq_prepare_nearest(exq_data *pExq);
+void				exq_fill_nearest(exq_nearest *pNear, exq_data *pExq,
+									 const unsigned char *pIndex, int num);
 unsigned char		exq_find_nearest_color(exq_data *pExp, exq_color *pColor);
+int					exq_search_nearest(const exq_nearest *pNear, const exq_color *pColor,
+									   exq_float bestv, int besti);
 exq_histogram		*exq_find_histogram(exq_data *pExp, unsigned char *pCol);
 
-void				exq_sort(exq_histogram **ppHist,
-						 exq_float (*sortfunc)(const exq_histogram *pHist));
-exq_float			exq_sort_by_r(const exq_histogram *pHist);
-exq_float			exq_sort_by_g(const exq_histogram *pHist);
-exq_float			exq_sort_by_b(const exq_histogram *pHist);
-exq_float			exq_sort_by_a(const exq_histogram *pHist);
-exq_float			exq_sort_by_dir(const exq_histogram *pHist);
-
-extern exq_color	exq_sort_dir;
+void				exq_alloc_members(exq_data *pExq);
+void				exq_reverse_members(exq_histogram **ppHist, int n);
+/* pTemp needs room for n items */
+void				exq_sort(exq_sort_item *pItems, exq_sort_item *pTemp, int n);
 
 #ifdef __cplusplus
 }
@@ -1,23 +1,41 @@
 #define _CRT_SECURE_NO_WARNINGS
+#include <algorithm>
+#include <atomic>
+#include <filesystem>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <vector>
+#include <ctype.h>
 #include <stdio.h>
 #include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
 #include "tinyxml2.h"
 #include "AnimFormat.h"
 #include "AnimExFormat.h"
 #include "AtbFormat.h"
 #include "mpanimbuild.h"
+#include "BuildServer.h"
+#include "FormatSelect.h"
+#include "MappedFile.h"
+#include "SimdDispatch.h"
+#include "TexBenchmark.h"
+#include "TextureCache.h"
+#include "ThreadPool.h"
+#include "TileEncoder.h"
 
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
 
 void PrintError(const char *fmt, ...)
 {
+    char message[1024];
     va_list args;
     va_start(args, fmt);
-    vfprintf(stderr, fmt, args);
-    exit(1);
+    vsnprintf(message, sizeof(message), fmt, args);
     va_end(args);
+    throw BuildError(message);
 }
 
 void PrintXmlError(tinyxml2::XMLError error_code)
@@ -27,181 +45,600 @@ void PrintXmlError(tinyxml2::XMLError error_code)
     }
 }
 
-void WriteU8(FILE *file, uint8_t value)
+static uint64_t RotateLeft64(uint64_t value, int shift)
 {
-    fwrite(&value, 1, 1, file);
+    return (value << shift) | (value >> (64 - shift));
 }
 
-void WriteS8(FILE *file, int8_t value)
+static uint64_t HashFinalize(uint64_t hash)
 {
-    fwrite(&value, 1, 1, file);
+    hash ^= hash >> 33;
+    hash *= 0xFF51AFD7ED558CCDULL;
+    hash ^= hash >> 33;
+    hash *= 0xC4CEB9FE1A85EC53ULL;
+    hash ^= hash >> 33;
+    return hash;
 }
 
-void WriteU16(FILE *file, uint16_t value)
+//MurmurHash3 Style 64-bit Hash, Only Used for Local Cache Keys so Endianness Doesn't Matter
+uint64_t HashData(const void *data, size_t size, uint64_t seed)
 {
-    uint8_t temp[2];
-    temp[0] = value >> 8;
-    temp[1] = value & 0xFF;
-    fwrite(temp, 2, 1, file);
+    const uint8_t *src = (const uint8_t *)data;
+    uint64_t hash = seed;
+    size_t remaining = size;
+    while (remaining >= 8) {
+        uint64_t value;
+        memcpy(&value, src, 8);
+        value *= 0x87C37B91114253D5ULL;
+        value = RotateLeft64(value, 31);
+        value *= 0x4CF5AD432745937FULL;
+        hash ^= value;
+        hash = (RotateLeft64(hash, 27) * 5) + 0x52DCE729;
+        src += 8;
+        remaining -= 8;
+    }
+    uint64_t tail = 0;
+    for (size_t i = 0; i < remaining; i++) {
+        tail |= (uint64_t)src[i] << (i * 8);
+    }
+    hash ^= tail * 0x87C37B91114253D5ULL;
+    return HashFinalize(hash ^ size);
 }
 
-void WriteS16(FILE *file, int16_t value)
+uint32_t GetTexDataSize(uint8_t format, int32_t w, int32_t h)
 {
-    int8_t temp[2];
-    temp[0] = value >> 8;
-    temp[1] = value & 0xFF;
-    fwrite(temp, 2, 1, file);
+    if (format >= TEX_FORMAT_COUNT) {
+        PrintError("Invalid texture format %d.\n", format);
+    }
+    const TexFormatInfo &info = tex_format_info[format];
+    uint32_t block_pitch = (w + info.block_w - 1) / info.block_w;
+    uint32_t num_y_blocks = (h + info.block_h - 1) / info.block_h;
+    uint32_t block_cnt = num_y_blocks * block_pitch;
+    return (block_cnt * info.block_w * info.block_h * info.bpp) / 8;
 }
 
-void WriteU32(FILE *file, uint32_t value)
+uint32_t GetTexBpp(uint8_t format)
 {
-    uint8_t temp[4];
-    temp[0] = value >> 24;
-    temp[1] = (value >> 16) & 0xFF;
-    temp[2] = (value >> 8) & 0xFF;
-    temp[3] = value & 0xFF;
-    fwrite(temp, 4, 1, file);
+    if (format >= TEX_FORMAT_COUNT) {
+        PrintError("Invalid texture format %d.\n", format);
+    }
+    return tex_format_info[format].bpp;
 }
 
-void WriteS32(FILE *file, int32_t value)
+uint8_t ParseCmprQuality(const char *name)
 {
-    int8_t temp[4];
-    temp[0] = value >> 24;
-    temp[1] = (value >> 16) & 0xFF;
-    temp[2] = (value >> 8) & 0xFF;
-    temp[3] = value & 0xFF;
-    fwrite(temp, 4, 1, file);
+    std::string quality_list[3] = { "fast", "range", "cluster" };
+    for (uint8_t i = 0; i < 3; i++) {
+        if (quality_list[i] == name) {
+            return i;
+        }
+    }
+    PrintError("Invalid CMPR quality %s.\n", name);
 }
 
-void WriteFloat(FILE *file, float value)
+uint32_t GetTexPalSize(uint8_t format)
 {
-    WriteS32(file, *(int32_t *)&value);
-}
+    switch (format) {
+        case TEX_FORMAT_CI8:
+            return 2 * 256;
 
-void AlignFile32(FILE *file)
-{
-    static uint8_t data = 0x88;
-    size_t ofs = ftell(file);
-    while (ofs % 32) {
-        fwrite(&data, 1, 1, file);
-        ofs = ftell(file);
+        case TEX_FORMAT_CI4:
+            return 2 * 16;
+
+        default:
+            return 0;
     }
 }
 
-uint32_t GetTexDataSize(uint8_t format, int32_t w, int32_t h)
-{
-    uint32_t block_w, block_h;
-    uint32_t bpp;
-    switch (format) {
-        case TEX_FORMAT_RGBA8:
-            bpp = 32;
-            block_w = 4;
-            block_h = 4;
-            break;
+#define INCREMENTAL_NONE 0
+#define INCREMENTAL_TIMESTAMP 1
+#define INCREMENTAL_HASH 2
 
-        case TEX_FORMAT_RGB5A3:
-            bpp = 16;
-            block_w = 4;
-            block_h = 4;
-            break;
+struct BuildOptions {
+    bool write_depfile;
+    bool map_output;
+    int incremental;
+    BuildLog *log;
+    EncodeOptions encode;
+};
 
-        case TEX_FORMAT_CI8:
-            bpp = 8;
-            block_w = 8;
-            block_h = 4;
-            break;
+struct BuildJob {
+    std::string xml_path;
+    std::string anim_file;
+};
 
-        case TEX_FORMAT_CI4:
-            bpp = 4;
-            block_w = 8;
-            block_h = 8;
-            break;
+static std::string GetDefaultAnimPath(std::string xml_path)
+{
+    return xml_path.substr(0, xml_path.find_last_of("."))+".anm";
+}
 
-        case TEX_FORMAT_IA8:
-            bpp = 16;
-            block_w = 4;
-            block_h = 4;
-            break;
+//Every file an animation XML pulls in, the XML itself first
+static std::vector<std::string> GetDependencies(tinyxml2::XMLElement *root, std::string xml_path, std::string base_path)
+{
+    std::vector<std::string> dependencies;
+    dependencies.push_back(xml_path);
+    tinyxml2::XMLElement *textures = root->FirstChildElement("textures");
+    if (!textures) {
+        return dependencies;
+    }
+    tinyxml2::XMLElement *texture_node = textures->FirstChildElement("texture");
+    while (texture_node) {
+        const char *file = texture_node->Attribute("file");
+        if (file && std::find(dependencies.begin(), dependencies.end(), base_path + file) == dependencies.end()) {
+            dependencies.push_back(base_path + file);
+        }
+        texture_node = texture_node->NextSiblingElement("texture");
+    }
+    return dependencies;
+}
 
-        case TEX_FORMAT_IA4:
-            bpp = 8;
-            block_w = 8;
-            block_h = 4;
-            break;
+static std::string EscapeDepfilePath(std::string path)
+{
+    std::string escaped;
+    for (size_t i = 0; i < path.length(); i++) {
+        if (path[i] == ' ' || path[i] == '#') {
+            escaped += '\\';
+        } else if (path[i] == '$') {
+            escaped += '$';
+        }
+        escaped += path[i];
+    }
+    return escaped;
+}
 
-        case TEX_FORMAT_I8:
-            bpp = 8;
-            block_w = 8;
-            block_h = 4;
-            break;
+//Make/Ninja Compatible Dependency File
+static void WriteDepfile(std::string path, std::string target, std::vector<std::string> &dependencies)
+{
+    FILE *file = fopen(path.c_str(), "w");
+    if (!file) {
+        PrintError("Failed to open %s for writing.\n", path.c_str());
+    }
+    fprintf(file, "%s:", EscapeDepfilePath(target).c_str());
+    for (size_t i = 0; i < dependencies.size(); i++) {
+        fprintf(file, " \\\n  %s", EscapeDepfilePath(dependencies[i]).c_str());
+    }
+    fprintf(file, "\n");
+    fclose(file);
+}
 
-        case TEX_FORMAT_I4:
-            bpp = 4;
-            block_w = 8;
-            block_h = 8;
-            break;
+static bool HashFile(std::string path, uint64_t &hash)
+{
+    FILE *file = fopen(path.c_str(), "rb");
+    if (!file) {
+        return false;
+    }
+    std::vector<uint8_t> contents;
+    uint8_t buf[65536];
+    size_t size;
+    while ((size = fread(buf, 1, sizeof(buf), file)) != 0) {
+        contents.insert(contents.end(), buf, buf + size);
+    }
+    fclose(file);
+    hash = HashData(contents.data(), contents.size(), 0);
+    return true;
+}
 
-        case TEX_FORMAT_A8:
-            bpp = 8;
-            block_w = 8;
-            block_h = 4;
-            break;
+//Hash of Every Input and the Settings Changing the Output Followed by the Hash of the Output They Produced
+static std::string GetHashStamp(std::string anim_file, std::vector<std::string> &dependencies, const EncodeOptions &options)
+{
+    //format="auto" picks formats by these so changing them has to rebuild
+    double settings[2] = { options.auto_psnr, (double)options.auto_max_error };
+    uint64_t input_hash = HashData(settings, sizeof(settings), 0);
+    for (size_t i = 0; i < dependencies.size(); i++) {
+        uint64_t hash;
+        if (!HashFile(dependencies[i], hash)) {
+            return "";
+        }
+        uint64_t pair[2] = { input_hash, hash };
+        input_hash = HashData(pair, sizeof(pair), dependencies[i].length());
+    }
+    uint64_t output_hash;
+    if (!HashFile(anim_file, output_hash)) {
+        return "";
+    }
+    char stamp[40];
+    snprintf(stamp, sizeof(stamp), "%016llx %016llx", (unsigned long long)input_hash, (unsigned long long)output_hash);
+    return stamp;
+}
 
-        case TEX_FORMAT_CMPR:
-            bpp = 4;
-            block_w = 8;
-            block_h = 8;
-            break;
+static std::string ReadStamp(std::string path)
+{
+    char stamp[64] = "";
+    FILE *file = fopen(path.c_str(), "r");
+    if (file) {
+        if (!fgets(stamp, sizeof(stamp), file)) {
+            stamp[0] = 0;
+        }
+        fclose(file);
+    }
+    std::string value = stamp;
+    while (!value.empty() && isspace((unsigned char)value.back())) {
+        value.pop_back();
+    }
+    return value;
+}
 
-        default:
-            PrintError("Invalid texture format %d.\n", format);
-            break;
+static bool IsUpToDate(BuildJob &job, BuildOptions &options, std::vector<std::string> &dependencies)
+{
+    std::error_code error;
+    if (options.write_depfile && !std::filesystem::exists(job.anim_file + ".d", error)) {
+        return false;
     }
-    uint32_t block_pitch = (w + block_w - 1) / block_w;
-    uint32_t num_y_blocks = (h + block_h - 1) / block_h;
-    uint32_t block_cnt = num_y_blocks * block_pitch;
-    return (block_cnt * block_w * block_h * bpp) / 8;
+    if (options.incremental == INCREMENTAL_HASH) {
+        std::string stamp = ReadStamp(job.anim_file + ".stamp");
+        return !stamp.empty() && stamp == GetHashStamp(job.anim_file, dependencies, options.encode);
+    }
+    std::filesystem::file_time_type output_time = std::filesystem::last_write_time(job.anim_file, error);
+    if (error) {
+        return false;
+    }
+    for (size_t i = 0; i < dependencies.size(); i++) {
+        std::filesystem::file_time_type input_time = std::filesystem::last_write_time(dependencies[i], error);
+        if (error || input_time > output_time) {
+            return false;
+        }
+    }
+    return true;
 }
 
-int main(int argc, char **argv)
+static void CheckOutputSize(BuildJob &job, ByteWriter &writer, uint32_t file_size)
 {
-    if (argc != 2 && argc != 3) {
-        printf("Usage: %s: anim_xml [anim_file]", argv[0]);
-        return 1;
+    if (writer.GetPosition() != file_size) {
+        PrintError("Wrote %u bytes to %s but planned %u.\n", (uint32_t)writer.GetPosition(), job.anim_file.c_str(), file_size);
     }
-    std::string xml_path = argv[1];
-    std::string xml_dir = xml_path;
+}
+
+//Returns False if the Output Was Already Up to Date
+static bool BuildAnim(BuildJob &job, BuildOptions &options)
+{
+    std::string xml_dir = job.xml_path;
     if (xml_dir.find_last_of("\\/") != std::string::npos) {
         xml_dir = xml_dir.substr(0, xml_dir.find_last_of("\\/")+1);
     } else {
         xml_dir = "";
     }
-    std::string anim_file;
-    if (argc == 3) {
-        anim_file = argv[2];
-    } else {
-        anim_file = xml_path.substr(0, xml_path.find_last_of("."))+".anm";
-    }
     tinyxml2::XMLDocument document;
-    PrintXmlError(document.LoadFile(xml_path.c_str()));
+    PrintXmlError(document.LoadFile(job.xml_path.c_str()));
     tinyxml2::XMLElement *root = document.FirstChild()->ToElement();
     if (root == NULL) {
         PrintXmlError(tinyxml2::XML_ERROR_FILE_READ_ERROR);
     }
+    std::vector<std::string> dependencies = GetDependencies(root, job.xml_path, xml_dir);
+    if (options.incremental != INCREMENTAL_NONE && IsUpToDate(job, options, dependencies)) {
+        return false;
+    }
     std::string type = root->Name();
-    AnimFormat *format = nullptr;
+    std::unique_ptr<AnimFormat> format;
     if (type == "anim") {
-        format = new AtbFormat(&document, xml_dir);
+        format.reset(new AtbFormat(&document, xml_dir, options.encode));
     } else if (type == "animex") {
-        format = new AnimExFormat(&document, xml_dir);
+        format.reset(new AnimExFormat(&document, xml_dir, options.encode));
+    } else {
+        PrintError("File %s is not a valid animation XML.\n", job.xml_path.c_str());
+    }
+    format->PlanLayout();
+    std::vector<std::string> &messages = format->GetMessages();
+    for (size_t i = 0; i < messages.size(); i++) {
+        options.log->Print("%s: %s\n", job.xml_path.c_str(), messages[i].c_str());
+    }
+    uint32_t file_size = format->GetLayout().GetTotalSize();
+    if (options.map_output) {
+        //The mapping is removed again if anything below fails
+        MappedFile file;
+        if (!file.Open(job.anim_file, file_size)) {
+            PrintError("Failed to map %s for writing.\n", job.anim_file.c_str());
+        }
+        ByteWriter writer(file.GetData(), file_size);
+        format->WriteData(writer);
+        CheckOutputSize(job, writer, file_size);
+        if (!file.Close()) {
+            PrintError("Failed to write %s.\n", job.anim_file.c_str());
+        }
     } else {
-        PrintError("File %s is not a valid animation XML.\n", xml_path.c_str());
+        //Output is built in memory first so a failed build never leaves a truncated file behind
+        ByteWriter writer;
+        writer.Reserve(file_size);
+        format->WriteData(writer);
+        CheckOutputSize(job, writer, file_size);
+        FILE *file = fopen(job.anim_file.c_str(), "wb");
+        if (!file) {
+            PrintError("Failed to open %s for writing.\n", job.anim_file.c_str());
+        }
+        bool written = writer.Flush(file);
+        if (fclose(file) != 0 || !written) {
+            remove(job.anim_file.c_str());
+            PrintError("Failed to write %s.\n", job.anim_file.c_str());
+        }
+    }
+    if (options.write_depfile) {
+        WriteDepfile(job.anim_file + ".d", job.anim_file, dependencies);
+    }
+    if (options.incremental == INCREMENTAL_HASH) {
+        std::string stamp_path = job.anim_file + ".stamp";
+        FILE *stamp_file = fopen(stamp_path.c_str(), "w");
+        if (!stamp_file) {
+            PrintError("Failed to open %s for writing.\n", stamp_path.c_str());
+        }
+        fprintf(stamp_file, "%s\n", GetHashStamp(job.anim_file, dependencies, options.encode).c_str());
+        fclose(stamp_file);
+    }
+    return true;
+}
+
+static std::vector<std::string> SplitResponseLine(std::string line)
+{
+    std::vector<std::string> tokens;
+    size_t i = 0;
+    while (i < line.length()) {
+        while (i < line.length() && isspace((unsigned char)line[i])) {
+            i++;
+        }
+        if (i >= line.length()) {
+            break;
+        }
+        std::string token;
+        if (line[i] == '"') {
+            size_t end = line.find('"', i + 1);
+            if (end == std::string::npos) {
+                end = line.length();
+            }
+            token = line.substr(i + 1, end - i - 1);
+            i = end + 1;
+        } else {
+            size_t start = i;
+            while (i < line.length() && !isspace((unsigned char)line[i])) {
+                i++;
+            }
+            token = line.substr(start, i - start);
+        }
+        tokens.push_back(token);
     }
-    FILE *file = fopen(anim_file.c_str(), "wb");
+    return tokens;
+}
+
+//Each line of a response file is anim_xml [anim_file]
+static void ReadResponseFile(std::string path, std::vector<BuildJob> &jobs)
+{
+    FILE *file = fopen(path.c_str(), "r");
     if (!file) {
-        PrintError("Failed to open %s for writing.\n", anim_file.c_str());
+        PrintError("Failed to open response file %s.\n", path.c_str());
+    }
+    char line[4096];
+    while (fgets(line, sizeof(line), file)) {
+        std::vector<std::string> tokens = SplitResponseLine(line);
+        if (tokens.empty() || tokens[0][0] == '#') {
+            continue;
+        }
+        if (tokens.size() > 2) {
+            fclose(file);
+            PrintError("Invalid line in response file %s: %s", path.c_str(), line);
+        }
+        BuildJob job;
+        job.xml_path = tokens[0];
+        if (tokens.size() == 2) {
+            job.anim_file = tokens[1];
+        } else {
+            job.anim_file = GetDefaultAnimPath(job.xml_path);
+        }
+        jobs.push_back(job);
     }
-    format->WriteData(file);
     fclose(file);
-    return 0;
-}
\ No newline at end of file
+}
+
+static std::string program_name = "mpanimbuild";
+
+BuildLog::BuildLog(bool capture)
+{
+    m_capture = capture;
+}
+
+void BuildLog::Print(const char *fmt, ...)
+{
+    char message[4096];
+    va_list args;
+    va_start(args, fmt);
+    vsnprintf(message, sizeof(message), fmt, args);
+    va_end(args);
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_capture) {
+        m_output += message;
+    } else {
+        fputs(message, stdout);
+    }
+}
+
+void BuildLog::Error(const char *fmt, ...)
+{
+    char message[4096];
+    va_list args;
+    va_start(args, fmt);
+    vsnprintf(message, sizeof(message), fmt, args);
+    va_end(args);
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_capture) {
+        m_errors += message;
+    } else {
+        fputs(message, stderr);
+    }
+}
+
+std::string BuildLog::GetOutput()
+{
+    return m_output;
+}
+
+std::string BuildLog::GetErrors()
+{
+    return m_errors;
+}
+
+static std::string ResolvePath(std::string work_dir, std::string path)
+{
+    if (work_dir.empty() || path.empty() || std::filesystem::path(path).is_absolute()) {
+        return path;
+    }
+    return (std::filesystem::path(work_dir) / path).string();
+}
+
+static void PrintUsage(BuildLog &log)
+{
+    const char *name = program_name.c_str();
+    log.Print("Usage: %s: anim_xml [anim_file]\n", name);
+    log.Print("       %s: -batch [-j threads] anim_xml|@response_file...\n", name);
+    log.Print("       %s: -server socket_path [-j threads]\n", name);
+    log.Print("       %s: -client socket_path [-shutdown|arguments...]\n", name);
+    log.Print("       %s: -benchmark [-simd level] [-iterations count] [image]\n", name);
+    log.Print("Options:\n");
+    log.Print("  -j threads       Number of worker threads\n");
+    log.Print("  -cache dir       Reuse encoded textures stored in dir\n");
+    log.Print("  -depfile         Write anim_file.d listing the XML and every image it uses\n");
+    log.Print("  -mmap            Write output through a memory mapping of its final size\n");
+    log.Print("  -simd level      Texture encoder SIMD level: auto, scalar, sse2 or avx2\n");
+    log.Print("  -verify-simd     Check SIMD texture encoder output against the scalar encoder\n");
+    log.Print("  -auto-psnr db    Lowest PSNR format=\"auto\" textures may have, default 40\n");
+    log.Print("  -auto-max-error value\n");
+    log.Print("                   Largest channel error format=\"auto\" textures may have, default 255\n");
+    log.Print("  -incremental     Skip animations whose output is newer than all inputs\n");
+    log.Print("  -incremental-hash\n");
+    log.Print("                   Skip animations whose inputs and output hash the same as\n");
+    log.Print("                   in anim_file.stamp from the last build\n");
+}
+
+EncodeOptions GetDefaultEncodeOptions()
+{
+    EncodeOptions options;
+    options.simd_level = SimdDispatch::GetSupportedLevel();
+    options.simd_verify = false;
+    options.auto_psnr = FORMAT_SELECT_DEFAULT_PSNR;
+    options.auto_max_error = FORMAT_SELECT_DEFAULT_MAX_ERROR;
+    return options;
+}
+
+int RunCommand(std::vector<std::string> args, std::string work_dir, BuildLog &log)
+{
+    bool batch = false;
+    uint32_t num_threads = 0;
+    BuildOptions options;
+    options.write_depfile = false;
+    options.map_output = false;
+    options.incremental = INCREMENTAL_NONE;
+    options.log = &log;
+    options.encode = GetDefaultEncodeOptions();
+    std::vector<std::string> paths;
+    for (size_t i = 0; i < args.size(); i++) {
+        std::string arg = args[i];
+        if (arg == "-batch") {
+            batch = true;
+        } else if (arg == "-j" && i + 1 < args.size()) {
+            num_threads = atoi(args[++i].c_str());
+        } else if (arg == "-cache" && i + 1 < args.size()) {
+            options.encode.cache_dir = ResolvePath(work_dir, args[++i]);
+        } else if (arg == "-depfile") {
+            options.write_depfile = true;
+        } else if (arg == "-mmap") {
+            options.map_output = true;
+        } else if (arg == "-simd" && i + 1 < args.size()) {
+            if (!SimdDispatch::ParseLevel(args[++i], options.encode.simd_level)) {
+                log.Error("Unknown SIMD level %s.\n", args[i].c_str());
+                return 1;
+            }
+            options.encode.simd_level = SimdDispatch::ClampLevel(options.encode.simd_level);
+        } else if (arg == "-verify-simd") {
+            options.encode.simd_verify = true;
+        } else if (arg == "-incremental") {
+            options.incremental = INCREMENTAL_TIMESTAMP;
+        } else if (arg == "-incremental-hash") {
+            options.incremental = INCREMENTAL_HASH;
+        } else if (arg == "-auto-psnr" && i + 1 < args.size()) {
+            options.encode.auto_psnr = atof(args[++i].c_str());
+        } else if (arg == "-auto-max-error" && i + 1 < args.size()) {
+            options.encode.auto_max_error = atoi(args[++i].c_str());
+        } else {
+            paths.push_back(arg);
+        }
+    }
+    //Requests without -j go back to the default so a build server never keeps an earlier request's thread count
+    if (num_threads == 0) {
+        num_threads = ThreadPool::GetDefaultThreadCount();
+    }
+    ThreadPool::SetThreadCount(num_threads);
+    std::vector<BuildJob> jobs;
+    try {
+        TextureCache::PrepareDirectory(options.encode.cache_dir);
+        if (batch) {
+            for (size_t i = 0; i < paths.size(); i++) {
+                if (paths[i][0] == '@') {
+                    ReadResponseFile(ResolvePath(work_dir, paths[i].substr(1)), jobs);
+                } else {
+                    BuildJob job;
+                    job.xml_path = paths[i];
+                    job.anim_file = GetDefaultAnimPath(paths[i]);
+                    jobs.push_back(job);
+                }
+            }
+        } else if (paths.size() == 1 || paths.size() == 2) {
+            BuildJob job;
+            job.xml_path = paths[0];
+            if (paths.size() == 2) {
+                job.anim_file = paths[1];
+            } else {
+                job.anim_file = GetDefaultAnimPath(job.xml_path);
+            }
+            jobs.push_back(job);
+        }
+    } catch (BuildError &error) {
+        log.Error("%s", error.what());
+        return 1;
+    }
+    if (jobs.empty()) {
+        PrintUsage(log);
+        return 1;
+    }
+    for (size_t i = 0; i < jobs.size(); i++) {
+        jobs[i].xml_path = ResolvePath(work_dir, jobs[i].xml_path);
+        jobs[i].anim_file = ResolvePath(work_dir, jobs[i].anim_file);
+    }
+    uint32_t cache_hits = TextureCache::GetHitCount();
+    uint32_t cache_misses = TextureCache::GetMissCount();
+    std::atomic<uint32_t> num_failed(0);
+    std::atomic<uint32_t> num_skipped(0);
+    ThreadPool::Get()->ParallelFor(jobs.size(), [&](uint32_t i) {
+        try {
+            if (!BuildAnim(jobs[i], options)) {
+                num_skipped++;
+            }
+        } catch (BuildError &error) {
+            if (batch) {
+                log.Error("%s: %s", jobs[i].xml_path.c_str(), error.what());
+            } else {
+                log.Error("%s", error.what());
+            }
+            num_failed++;
+        }
+    });
+    if (batch) {
+        log.Print("Built %u of %u animations, %u already up to date.\n", (uint32_t)(jobs.size() - num_failed - num_skipped),
+            (uint32_t)jobs.size(), (uint32_t)num_skipped);
+    }
+    if (TextureCache::IsEnabled(options.encode)) {
+        log.Print("Texture cache: %u hits, %u misses.\n", TextureCache::GetHitCount() - cache_hits, TextureCache::GetMissCount() - cache_misses);
+    }
+    return num_failed ? 1 : 0;
+}
+
+int main(int argc, char **argv)
+{
+    program_name = argv[0];
+    std::vector<std::string> args(argv + 1, argv + argc);
+    if (args.size() >= 2 && args[0] == "-server") {
+        return RunBuildServer(args[1], std::vector<std::string>(args.begin() + 2, args.end()));
+    }
+    if (args.size() >= 2 && args[0] == "-client") {
+        return RunBuildClient(args[1], std::vector<std::string>(args.begin() + 2, args.end()));
+    }
+    if (args.size() >= 1 && args[0] == "-benchmark") {
+        return RunTextureBenchmark(std::vector<std::string>(args.begin() + 1, args.end()));
+    }
+    BuildLog log(false);
+    return RunCommand(args, "", log);
+}
@@ -1,6 +1,12 @@
 #pragma once
 
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <vector>
 #include "tinyxml2.h"
+#include "ByteWriter.h"
+#include "LayoutPlan.h"
 
 #define TEX_FORMAT_RGBA8 0
 #define TEX_FORMAT_RGB5A3 1
@@ -14,16 +20,110 @@
 #define TEX_FORMAT_CMPR 9
 #define TEX_FORMAT_COUNT 10
 
-void PrintError(const char *fmt, ...);
+//CMPR endpoint search, from fastest to best looking
+#define CMPR_QUALITY_FAST 0
+//Endpoints at the ends of the principal axis of each block, about as fast as fast
+#define CMPR_QUALITY_RANGE 1
+//Least squares endpoints for the runs of palette entries found along the axis, around 6 times slower than range
+#define CMPR_QUALITY_CLUSTER 2
+
+//Settings of one build, passed down to the encoders so build server requests never see each other's
+struct EncodeOptions {
+    //SIMD_LEVEL_* the encoders use, at most SimdDispatch::GetSupportedLevel
+    int simd_level;
+    //Also runs the scalar reference code and errors if SIMD output differs from it
+    bool simd_verify;
+    //Encoded textures are reused from and stored in this directory when it is not empty
+    std::string cache_dir;
+    //format="auto" textures need at least this PSNR in dB and no channel off by more than auto_max_error
+    double auto_psnr;
+    int32_t auto_max_error;
+};
+
+//Thrown by PrintError so one failed animation doesn't take down a whole batch
+class BuildError : public std::runtime_error
+{
+public:
+    BuildError(const std::string &message) : std::runtime_error(message) {}
+};
+
+//Collects build messages for a server client or prints them straight to the console
+class BuildLog
+{
+public:
+    BuildLog(bool capture);
+    void Print(const char *fmt, ...);
+    void Error(const char *fmt, ...);
+    std::string GetOutput();
+    std::string GetErrors();
+
+private:
+    bool m_capture;
+    std::mutex m_mutex;
+    std::string m_output;
+    std::string m_errors;
+};
+
+//Runs a build from command line arguments, relative paths are resolved against work_dir
+int RunCommand(std::vector<std::string> args, std::string work_dir, BuildLog &log);
+//Best SIMD level without verification, no cache directory and the default format="auto" thresholds
+EncodeOptions GetDefaultEncodeOptions();
+[[noreturn]] void PrintError(const char *fmt, ...);
 void PrintXmlError(tinyxml2::XMLError error_code);
-void WriteU8(FILE *file, uint8_t value);
-void WriteS8(FILE *file, int8_t value);
-void WriteU16(FILE *file, uint16_t value);
-void WriteS16(FILE *file, int16_t value);
-void WriteU32(FILE *file, uint32_t value);
-void WriteS32(FILE *file, int32_t value);
-void WriteFloat(FILE *file, float value);
+uint64_t HashData(const void *data, size_t size, uint64_t seed);
 uint32_t GetTexDataSize(uint8_t format, int32_t w, int32_t h);
-void AlignFile32(FILE *file);
-//Writes Palette Immediately Before Texture if Used
-void TextureWrite(FILE *file, uint8_t format, int32_t w, int32_t h, uint8_t *src);
\ No newline at end of file
+uint32_t GetTexPalSize(uint8_t format);
+uint32_t GetTexBpp(uint8_t format);
+//Parses the cmpr_quality attribute of a texture, fast, range or cluster
+uint8_t ParseCmprQuality(const char *name);
+
+struct EncodedTexture {
+    std::vector<uint8_t> pal_data;
+    std::vector<uint8_t> tex_data;
+};
+
+struct TextureSource {
+    uint8_t format;
+    int32_t w;
+    int32_t h;
+    uint8_t *data;
+    uint8_t cmpr_quality;
+    //Textures with the same palette_group share the palette written before the first of them, -1 for none
+    int32_t palette_group;
+    //Output format="auto" selection already encoded, written as is outside palette groups, nullptr to encode data
+    const EncodedTexture *encoded;
+};
+
+//Palette is Left Empty for Non-CI Formats
+void TextureEncode(uint8_t format, int32_t w, int32_t h, uint8_t *src, EncodedTexture &texture, uint8_t cmpr_quality, const EncodeOptions &options);
+//Same as TextureEncode but Reuses and Stores Results in the Texture Cache When options Enable It
+void TextureEncodeCached(uint8_t format, int32_t w, int32_t h, uint8_t *src, EncodedTexture &texture, uint8_t cmpr_quality, const EncodeOptions &options);
+//Encodes Straight Into Place, pal_dst Needs GetTexPalSize Bytes and tex_dst GetTexDataSize Bytes
+void TextureEncode(uint8_t format, int32_t w, int32_t h, uint8_t *src, uint8_t *pal_dst, uint8_t *tex_dst, uint8_t cmpr_quality, const EncodeOptions &options);
+//Decodes a Texture Back to RGBA8 the Way the Hardware Samples It, pal is Ignored for Non-CI Formats
+void TextureDecode(uint8_t format, int32_t w, int32_t h, uint8_t *pal, uint8_t *tex, uint8_t *dst);
+//Quantizes CI4 or CI8 Textures Into One Shared Palette, Each tex_dsts Entry Needs GetTexDataSize Bytes
+void TextureEncodeGroup(std::vector<TextureSource> &textures, uint8_t *pal_dst, std::vector<uint8_t *> &tex_dsts, const EncodeOptions &options);
+//Textures quantized together into one palette
+struct PaletteGroup {
+    std::string name;
+    uint8_t format;
+};
+
+//Palette sections planned for each palette group and how many members share them
+struct PaletteGroupSections {
+    std::vector<uint32_t> sections;
+    uint32_t num_shared;
+    uint32_t saved_size;
+};
+
+//Index of the Palette Group a TEX_FORMAT_ Texture Joins, Adding it if Needed, or -1 for an Empty name
+int32_t FindPaletteGroup(std::vector<PaletteGroup> &groups, std::string name, uint8_t format);
+//Plans the Palette Section Before a Texture, Palette Group Members After the First Reuse the First Member's Section
+uint32_t PlanPaletteSection(LayoutPlan &layout, std::vector<TextureSource> &textures, uint32_t index, std::string name, PaletteGroupSections &group_sections);
+//Palette Bytes Written Before a Texture, Zero for Palette Group Members After the First
+uint32_t GetSourcePalSize(std::vector<TextureSource> &textures, uint32_t index);
+//Index of the First Texture Encoding to the Same Bytes for Each Texture, or its Own Index if There is None
+std::vector<uint32_t> FindDuplicateTextures(std::vector<TextureSource> &textures);
+//Encodes Every Texture in Parallel Straight Into the Output, Each Palette Immediately Before its Texture
+void TextureWriteAll(ByteWriter &writer, std::vector<TextureSource> &textures, const EncodeOptions &options);
\ No newline at end of file
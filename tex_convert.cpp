@@ -1,6 +1,18 @@
 #include <assert.h>
+#include <string.h>
+#include <algorithm>
+#include <unordered_map>
 #include "mpanimbuild.h"
+#include "tex_convert.h"
 #include "exoquant.h"
+#include "CmprFit.h"
+#include "TexConvertSimd.h"
+#include "TextureCache.h"
+#include "ThreadPool.h"
+#include "TileEncoder.h"
+
+//Pixels per band of rows when building CI histograms in parallel
+#define FEED_BAND_PIXELS 65536
 
 static uint8_t color_5_to_8[32] = {
     0x00, 0x08, 0x10, 0x19, 0x21, 0x29, 0x31, 0x3a, 0x42, 0x4a, 0x52,
@@ -17,7 +29,7 @@ static uint8_t color_6_to_8[64] = {
     0xdf, 0xe3, 0xe7, 0xeb, 0xef, 0xf3, 0xf7, 0xfb, 0xff
 };
 
-static uint8_t color_8_to_3[256] = {
+uint8_t color_8_to_3[256] = {
     0x00,0x00,0x00,0x00, 0x00,0x00,0x00,0x00, 0x00,0x00,0x00,0x00, 0x00,0x00,0x00,0x00,
     0x00,0x00,0x00,0x01, 0x01,0x01,0x01,0x01, 0x01,0x01,0x01,0x01, 0x01,0x01,0x01,0x01,
     0x01,0x01,0x01,0x01, 0x01,0x01,0x01,0x01, 0x01,0x01,0x01,0x01, 0x01,0x01,0x01,0x01,
@@ -36,7 +48,7 @@ static uint8_t color_8_to_3[256] = {
     0x07,0x07,0x07,0x07, 0x07,0x07,0x07,0x07, 0x07,0x07,0x07,0x07, 0x07,0x07,0x07,0x07
 };
 
-static uint8_t color_8_to_4[256] = {
+uint8_t color_8_to_4[256] = {
     0x00,0x00,0x00,0x00, 0x00,0x00,0x00,0x00, 0x00,0x01,0x01,0x01, 0x01,0x01,0x01,0x01,
     0x01,0x01,0x01,0x01, 0x01,0x01,0x01,0x01, 0x01,0x01,0x02,0x02, 0x02,0x02,0x02,0x02,
     0x02,0x02,0x02,0x02, 0x02,0x02,0x02,0x02, 0x02,0x02,0x02,0x03, 0x03,0x03,0x03,0x03,
@@ -55,7 +67,7 @@ static uint8_t color_8_to_4[256] = {
     0x0e,0x0e,0x0e,0x0e, 0x0e,0x0e,0x0e,0x0f, 0x0f,0x0f,0x0f,0x0f, 0x0f,0x0f,0x0f,0x0f
 };
 
-static uint8_t color_8_to_5[256] = {
+uint8_t color_8_to_5[256] = {
     0x00,0x00,0x00,0x00, 0x00,0x01,0x01,0x01, 0x01,0x01,0x01,0x01, 0x01,0x02,0x02,0x02,
     0x02,0x02,0x02,0x02, 0x02,0x03,0x03,0x03, 0x03,0x03,0x03,0x03, 0x03,0x04,0x04,0x04,
     0x04,0x04,0x04,0x04, 0x04,0x04,0x05,0x05, 0x05,0x05,0x05,0x05, 0x05,0x05,0x06,0x06,
@@ -74,7 +86,7 @@ static uint8_t color_8_to_5[256] = {
     0x1d,0x1d,0x1d,0x1e, 0x1e,0x1e,0x1e,0x1e, 0x1e,0x1e,0x1e,0x1f, 0x1f,0x1f,0x1f,0x1f
 };
 
-static uint8_t color_8_to_6[256] = {
+uint8_t color_8_to_6[256] = {
     0x00, 0x00, 0x00, 0x01, 0x01, 0x01, 0x01, 0x02, 0x02, 0x02, 0x02, 0x03,
     0x03, 0x03, 0x03, 0x04, 0x04, 0x04, 0x04, 0x05, 0x05, 0x05, 0x05, 0x06,
     0x06, 0x06, 0x06, 0x07, 0x07, 0x07, 0x07, 0x08, 0x08, 0x08, 0x08, 0x09,
@@ -101,20 +113,9 @@ static uint8_t color_8_to_6[256] = {
 
 static void ConvertTextureRGBA8(int32_t w, int32_t h, uint8_t *src, uint8_t *dst)
 {
-	for (int32_t i = 0; i < h; i++) {
-		for (int32_t j = 0; j < w; j++) {
-			int32_t block_pitch = (w + 3) / 4;
-			int32_t block_y_idx = i / 4;
-			int32_t block_x_idx = j / 4;
-			int32_t block_idx = (block_pitch * block_y_idx) + block_x_idx;
-			int32_t pixel_idx = ((i % 4) * 4) + (j % 4);
-			uint32_t pixel_ofs = (block_idx * 64) + (pixel_idx * 2);
-			dst[pixel_ofs] = src[(((i * w) + j) * 4) + 3];
-			dst[pixel_ofs+1] = src[((i * w) + j) * 4];
-			dst[pixel_ofs+32] = src[(((i * w) + j) * 4) + 1];
-			dst[pixel_ofs+33] = src[(((i * w) + j) * 4) + 2];
-		}
-	}
+	TileEncoder<TEX_FORMAT_RGBA8>::Encode<4>(w, h, src, dst, [](uint8_t *color) {
+		return ((uint32_t)color[3] << 24) | (color[0] << 16) | (color[1] << 8) | color[2];
+	});
 }
 
 static void WriteU16Mem(uint8_t *dst, uint16_t value)
@@ -123,7 +124,15 @@ static void WriteU16Mem(uint8_t *dst, uint16_t value)
     dst[1] = value & 0xFF;
 }
 
-static void ConvertColorRGB5A3(uint8_t *dst, uint8_t *color)
+uint8_t GetIntensity(uint8_t *color)
+{
+    float r = color[0] * 0.3f;
+    float g = color[1] * 0.59f;
+    float b = color[2] * 0.11f;
+    return (uint8_t)(r + g + b);
+}
+
+uint16_t EncodeRGB5A3(uint8_t *color)
 {
     uint16_t value;
     if (color_8_to_3[color[3]] == 7) {
@@ -131,184 +140,198 @@ static void ConvertColorRGB5A3(uint8_t *dst, uint8_t *color)
     } else {
         value = (color_8_to_3[color[3]] << 12) | (color_8_to_4[color[0]] << 8) | (color_8_to_4[color[1]] << 4) | color_8_to_4[color[2]];
     }
-    WriteU16Mem(dst, value);
+    return value;
 }
 
-static void ConvertTextureRGB5A3(int32_t w, int32_t h, uint8_t *src, uint8_t *dst)
+void ConvertColorRGB5A3(uint8_t *dst, uint8_t *color)
 {
-    for (int32_t i = 0; i < h; i++) {
-        for (int32_t j = 0; j < w; j++) {
-            int32_t block_pitch = (w + 3) / 4;
-            int32_t block_y_idx = i / 4;
-            int32_t block_x_idx = j / 4;
-            int32_t block_idx = (block_pitch * block_y_idx) + block_x_idx;
-            int32_t pixel_idx = ((i % 4) * 4) + (j % 4);
-            uint32_t pixel_ofs = (block_idx * 32) + (pixel_idx * 2);
-            ConvertColorRGB5A3(&dst[pixel_ofs], &src[((i * w) + j) * 4]);
-        }
+    WriteU16Mem(dst, EncodeRGB5A3(color));
+}
+
+//Scalar reference version of the PackKernels step
+static void ConvertRGB5A3(uint8_t *src, int32_t count, uint8_t *dst)
+{
+    for (int32_t i = 0; i < count; i++) {
+        ConvertColorRGB5A3(&dst[i * 2], &src[i * 4]);
     }
 }
 
-static uint8_t pal_data[2*256];
+PackKernels GetPackKernels(int level)
+{
+    PackKernels kernels = { ConvertRGB5A3 };
+#ifdef SIMD_X86
+    if (level == SIMD_LEVEL_AVX2) {
+        kernels.rgb5a3 = ConvertRGB5A3_AVX2;
+    } else if (level == SIMD_LEVEL_SSE2) {
+        kernels.rgb5a3 = ConvertRGB5A3_SSE2;
+    }
+#endif
+    return kernels;
+}
 
-static void ConvertTextureCI8(int32_t w, int32_t h, uint8_t *src, uint8_t *dst)
+//Compares the output of a whole texture kernel against its scalar version when -verify-simd is on
+static void VerifyPixelKernel(const char *name, int32_t w, int32_t h, int32_t pixel_size, uint8_t *src, uint8_t *dst,
+    void (*scalar)(uint8_t *src, int32_t count, uint8_t *dst), const EncodeOptions &options)
 {
-    uint8_t *pal_buf = new uint8_t[256 * 4]();
-    uint8_t *data_buf =  new uint8_t[w * h]();
-    exq_data *exq_data = exq_init();
-    exq_feed(exq_data, src, w*h);
-    exq_quantize_hq(exq_data, 256);
-    exq_get_palette(exq_data, pal_buf, 256);
-    exq_map_image_ordered(exq_data, w, h, src, data_buf);
-    exq_free(exq_data);
-    for (int32_t i = 0; i < 256; i++) {
-        ConvertColorRGB5A3(&pal_data[i*2], &pal_buf[i*4]);
+    if (!options.simd_verify || options.simd_level == SIMD_LEVEL_SCALAR) {
+        return;
     }
-    for (int32_t i = 0; i < h; i++) {
-        for (int32_t j = 0; j < w; j++) {
-            int32_t block_pitch = (w + 7) / 8;
-            int32_t block_y_idx = i / 4;
-            int32_t block_x_idx = j / 8;
-            int32_t block_idx = (block_pitch * block_y_idx) + block_x_idx;
-            int32_t pixel_idx = ((i % 4) * 8) + (j % 8);
-            uint32_t pixel_ofs = (block_idx * 32) + pixel_idx;
-            dst[pixel_ofs] = data_buf[((i * w) + j)];
+    std::vector<uint8_t> ref_buf(w * h * pixel_size);
+    scalar(src, w * h, ref_buf.data());
+    for (int32_t i = 0; i < w * h; i++) {
+        if (memcmp(&ref_buf[i * pixel_size], &dst[i * pixel_size], pixel_size) != 0) {
+            PrintError("%s %s output differs from scalar at pixel (%d, %d).\n", SimdDispatch::GetLevelName(options.simd_level),
+                name, i % w, i / w);
         }
     }
-    delete[] pal_buf;
-    delete[] data_buf;
 }
 
-static void ConvertTextureCI4(int32_t w, int32_t h, uint8_t *src, uint8_t *dst)
+//Fills dst with the big endian RGB5A3 value of every pixel
+static void ConvertRGB5A3Buffer(int32_t w, int32_t h, uint8_t *src, uint8_t *dst, const EncodeOptions &options)
 {
-    uint8_t *pal_buf = new uint8_t[16 * 4]();
-    uint8_t *data_buf = new uint8_t[w * h]();
-    exq_data *exq_data = exq_init();
-    exq_feed(exq_data, src, w * h);
-    exq_quantize_hq(exq_data, 16);
-    exq_get_palette(exq_data, pal_buf, 16);
-    exq_map_image_ordered(exq_data, w, h, src, data_buf);
-    exq_free(exq_data);
-    for (int32_t i = 0; i < 16; i++) {
-        ConvertColorRGB5A3(&pal_data[i * 2], &pal_buf[i * 4]);
-    }
-    for (int32_t i = 0; i < h; i++) {
-        for (int32_t j = 0; j < w; j++) {
-            int32_t block_pitch = (w + 7) / 8;
-            int32_t block_y_idx = i / 8;
-            int32_t block_x_idx = j / 8;
-            int32_t block_idx = (block_pitch * block_y_idx) + block_x_idx;
-            int32_t pixel_idx = ((i % 8) * 8) + (j % 8);
-            uint32_t pixel_ofs = (block_idx * 32) + (pixel_idx / 2);
-            if (j % 2) {
-                dst[pixel_ofs] |= data_buf[((i * w) + j)];
-            } else {
-                dst[pixel_ofs] = data_buf[((i * w) + j)] << 4;
+    GetPackKernels(options.simd_level).rgb5a3(src, w * h, dst);
+    VerifyPixelKernel("RGB5A3", w, h, 2, src, dst, ConvertRGB5A3, options);
+}
+
+static void ConvertTextureRGB5A3(int32_t w, int32_t h, uint8_t *src, uint8_t *dst, const EncodeOptions &options)
+{
+    uint8_t *color_buf = new uint8_t[w * h * 2];
+    ConvertRGB5A3Buffer(w, h, src, color_buf, options);
+    TileEncoder<TEX_FORMAT_RGB5A3>::Encode<2>(w, h, color_buf, dst, [](uint8_t *color) {
+        return (color[0] << 8) | color[1];
+    });
+    delete[] color_buf;
+}
+
+//Gives every distinct RGB5A3 color its own palette entry when there are at most num_colors of them
+//That matches what an RGB5A3 texture would store so quantizing and dithering are skipped
+static bool FindExactPalette(std::vector<TextureSource> &textures, int32_t num_colors, uint8_t *pal_dst, std::vector<uint8_t *> &index_dsts,
+    const EncodeOptions &options)
+{
+    std::vector<int16_t> color_index(65536, -1);
+    int32_t count = 0;
+    memset(pal_dst, 0, num_colors * 2);
+    for (size_t i = 0; i < textures.size(); i++) {
+        int32_t num_pixels = textures[i].w * textures[i].h;
+        std::vector<uint8_t> color_buf(num_pixels * 2);
+        ConvertRGB5A3Buffer(textures[i].w, textures[i].h, textures[i].data, color_buf.data(), options);
+        for (int32_t j = 0; j < num_pixels; j++) {
+            uint16_t color = (color_buf[j * 2] << 8) | color_buf[(j * 2) + 1];
+            if (color_index[color] < 0) {
+                if (count == num_colors) {
+                    return false;
+                }
+                color_index[color] = count;
+                pal_dst[count * 2] = color_buf[j * 2];
+                pal_dst[(count * 2) + 1] = color_buf[(j * 2) + 1];
+                count++;
             }
+            index_dsts[i][j] = color_index[color];
         }
     }
-    delete[] pal_buf;
-    delete[] data_buf;
-}
-
-static void ConvertTextureIA8(int32_t w, int32_t h, uint8_t *src, uint8_t *dst)
-{
-    for (int32_t i = 0; i < h; i++) {
-        for (int32_t j = 0; j < w; j++) {
-            int32_t block_pitch = (w + 3) / 4;
-            int32_t block_y_idx = i / 4;
-            int32_t block_x_idx = j / 4;
-            int32_t block_idx = (block_pitch * block_y_idx) + block_x_idx;
-            int32_t pixel_idx = ((i % 4) * 4) + (j % 4);
-            uint32_t pixel_ofs = (block_idx * 32) + (pixel_idx * 2);
-            float r = src[((i * w) + j) * 4] * 0.3f;
-            float g = src[(((i * w) + j) * 4) + 1] * 0.59f;
-            float b = src[(((i * w) + j) * 4) + 2] * 0.11f;
-            uint8_t a = src[(((i * w) + j) * 4) + 3];
-            uint8_t intensity = (uint8_t)(r + g + b);
-            dst[pixel_ofs] = a;
-            dst[pixel_ofs + 1] = intensity;
-        }
-    }
+    return true;
 }
 
-static void ConvertTextureIA4(int32_t w, int32_t h, uint8_t *src, uint8_t *dst)
+//The palette goes straight into pal_dst so any number of textures can be converted at once
+static void ConvertTextureCI(uint8_t format, int32_t w, int32_t h, uint8_t *src, uint8_t *pal_dst, uint8_t *dst, const EncodeOptions &options)
 {
-    for (int32_t i = 0; i < h; i++) {
-        for (int32_t j = 0; j < w; j++) {
-            int32_t block_pitch = (w + 7) / 8;
-            int32_t block_y_idx = i / 4;
-            int32_t block_x_idx = j / 8;
-            int32_t block_idx = (block_pitch * block_y_idx) + block_x_idx;
-            int32_t pixel_idx = ((i % 4) * 8) + (j % 8);
-            uint32_t pixel_ofs = (block_idx * 32) + pixel_idx;
-            float r = src[((i * w) + j) * 4] * 0.3f;
-            float g = src[(((i * w) + j) * 4) + 1] * 0.59f;
-            float b = src[(((i * w) + j) * 4) + 2] * 0.11f;
-            uint8_t a = color_8_to_4[src[(((i * w) + j) * 4) + 3]];
-            uint8_t intensity = color_8_to_4[(uint8_t)(r + g + b)];
-            dst[pixel_ofs] = (a << 4)| intensity;
-        }
+    std::vector<TextureSource> textures(1);
+    textures[0].format = format;
+    textures[0].w = w;
+    textures[0].h = h;
+    textures[0].data = src;
+    std::vector<uint8_t *> tex_dsts(1, dst);
+    TextureEncodeGroup(textures, pal_dst, tex_dsts, options);
+}
+
+//Scalar reference versions of the IntensityKernels steps
+static void ConvertIntensity(uint8_t *src, int32_t count, uint8_t *dst)
+{
+    for (int32_t i = 0; i < count; i++) {
+        dst[i] = GetIntensity(&src[i * 4]);
     }
 }
 
-static void ConvertTextureI8(int32_t w, int32_t h, uint8_t *src, uint8_t *dst)
+static void ConvertIntensityAlpha(uint8_t *src, int32_t count, uint8_t *dst)
 {
-    for (int32_t i = 0; i < h; i++) {
-        for (int32_t j = 0; j < w; j++) {
-            int32_t block_pitch = (w + 7) / 8;
-            int32_t block_y_idx = i / 4;
-            int32_t block_x_idx = j / 8;
-            int32_t block_idx = (block_pitch * block_y_idx) + block_x_idx;
-            int32_t pixel_idx = ((i % 4) * 8) + (j % 8);
-            uint32_t pixel_ofs = (block_idx * 32) + pixel_idx;
-            float r = src[((i * w) + j) * 4] * 0.3f;
-            float g = src[(((i * w) + j) * 4) + 1] * 0.59f;
-            float b = src[(((i * w) + j) * 4) + 2] * 0.11f;
-            uint8_t intensity = (((uint8_t)(r + g + b)) * src[(((i * w) + j) * 4) + 3]) / 255;
-            dst[pixel_ofs] = intensity;
-        }
+    for (int32_t i = 0; i < count; i++) {
+        dst[i] = (GetIntensity(&src[i * 4]) * src[(i * 4) + 3]) / 255;
     }
 }
 
-static void ConvertTextureI4(int32_t w, int32_t h, uint8_t *src, uint8_t *dst)
+IntensityKernels GetIntensityKernels(int level)
 {
+    IntensityKernels kernels = { ConvertIntensity, ConvertIntensityAlpha };
+#ifdef SIMD_X86
+    if (level == SIMD_LEVEL_AVX2) {
+        kernels.intensity = ConvertIntensity_AVX2;
+        kernels.intensity_alpha = ConvertIntensityAlpha_AVX2;
+    } else if (level == SIMD_LEVEL_SSE2) {
+        kernels.intensity = ConvertIntensity_SSE2;
+        kernels.intensity_alpha = ConvertIntensityAlpha_SSE2;
+    }
+#endif
+    return kernels;
+}
 
-    for (int32_t i = 0; i < h; i++) {
-        for (int32_t j = 0; j < w; j++) {
-            int32_t block_pitch = (w + 7) / 8;
-            int32_t block_y_idx = i / 8;
-            int32_t block_x_idx = j / 8;
-            int32_t block_idx = (block_pitch * block_y_idx) + block_x_idx;
-            int32_t pixel_idx = ((i % 8) * 8) + (j % 8);
-            uint32_t pixel_ofs = (block_idx * 32) + (pixel_idx / 2);
-            float r = src[((i * w) + j) * 4] * 0.3f;
-            float g = src[(((i * w) + j) * 4) + 1] * 0.59f;
-            float b = src[(((i * w) + j) * 4) + 2] * 0.11f;
-            uint8_t intensity = (((uint8_t)(r + g + b)) * src[(((i * w) + j) * 4) + 3]) / 255;
-            intensity = color_8_to_4[intensity];
-            if (j % 2) {
-                dst[pixel_ofs] |= intensity;
-            } else {
-                dst[pixel_ofs] = intensity << 4;
-            }
-        }
+//Fills dst with one intensity byte per pixel, weighted by alpha for the I formats
+static void ConvertIntensityBuffer(int32_t w, int32_t h, uint8_t *src, uint8_t *dst, bool alpha_weight, const EncodeOptions &options)
+{
+    IntensityKernels kernels = GetIntensityKernels(options.simd_level);
+    if (alpha_weight) {
+        kernels.intensity_alpha(src, w * h, dst);
+        VerifyPixelKernel("intensity", w, h, 1, src, dst, ConvertIntensityAlpha, options);
+    } else {
+        kernels.intensity(src, w * h, dst);
+        VerifyPixelKernel("intensity", w, h, 1, src, dst, ConvertIntensity, options);
     }
 }
 
+static void ConvertTextureIA8(int32_t w, int32_t h, uint8_t *src, uint8_t *dst, const EncodeOptions &options)
+{
+    uint8_t *intensity_buf = new uint8_t[w * h];
+    ConvertIntensityBuffer(w, h, src, intensity_buf, false, options);
+    TileEncoder<TEX_FORMAT_IA8>::Encode<4>(w, h, src, dst, [src, intensity_buf](uint8_t *color) {
+        return (color[3] << 8) | intensity_buf[(color - src) / 4];
+    });
+    delete[] intensity_buf;
+}
+
+static void ConvertTextureIA4(int32_t w, int32_t h, uint8_t *src, uint8_t *dst, const EncodeOptions &options)
+{
+    uint8_t *intensity_buf = new uint8_t[w * h];
+    ConvertIntensityBuffer(w, h, src, intensity_buf, false, options);
+    TileEncoder<TEX_FORMAT_IA4>::Encode<4>(w, h, src, dst, [src, intensity_buf](uint8_t *color) {
+        return (color_8_to_4[color[3]] << 4) | color_8_to_4[intensity_buf[(color - src) / 4]];
+    });
+    delete[] intensity_buf;
+}
+
+static void ConvertTextureI8(int32_t w, int32_t h, uint8_t *src, uint8_t *dst, const EncodeOptions &options)
+{
+    uint8_t *intensity_buf = new uint8_t[w * h];
+    ConvertIntensityBuffer(w, h, src, intensity_buf, true, options);
+    TileEncoder<TEX_FORMAT_I8>::Encode<1>(w, h, intensity_buf, dst, [](uint8_t *intensity) {
+        return *intensity;
+    });
+    delete[] intensity_buf;
+}
+
+static void ConvertTextureI4(int32_t w, int32_t h, uint8_t *src, uint8_t *dst, const EncodeOptions &options)
+{
+    uint8_t *intensity_buf = new uint8_t[w * h];
+    ConvertIntensityBuffer(w, h, src, intensity_buf, true, options);
+    TileEncoder<TEX_FORMAT_I4>::Encode<1>(w, h, intensity_buf, dst, [](uint8_t *intensity) {
+        return color_8_to_4[*intensity];
+    });
+    delete[] intensity_buf;
+}
+
 static void ConvertTextureA8(int32_t w, int32_t h, uint8_t *src, uint8_t *dst)
 {
-    for (int32_t i = 0; i < h; i++) {
-        for (int32_t j = 0; j < w; j++) {
-            int32_t block_pitch = (w + 7) / 8;
-            int32_t block_y_idx = i / 4;
-            int32_t block_x_idx = j / 8;
-            int32_t block_idx = (block_pitch * block_y_idx) + block_x_idx;
-            int32_t pixel_idx = ((i % 4) * 8) + (j % 8);
-            uint32_t pixel_ofs = (block_idx * 32) + pixel_idx;
-            dst[pixel_ofs] = src[(((i * w) + j) * 4) + 3];
-        }
-    }
+    TileEncoder<TEX_FORMAT_A8>::Encode<4>(w, h, src, dst, [](uint8_t *color) {
+        return color[3];
+    });
 }
 
 static int32_t Distance(uint8_t *color1, uint8_t *color2)
@@ -322,55 +345,137 @@ static int32_t Distance(uint8_t *color1, uint8_t *color2)
     return temp;
 }
 
-static int32_t LeastDistance(uint8_t *palette, uint8_t *color)
+//Scalar reference versions of the CmprKernels steps
+static int32_t FindEndpointsCMPR(uint8_t *block, uint32_t row_mask, int32_t *col1, int32_t *col2)
 {
-    int32_t dist, best, temp;
+    int32_t dist, temp;
+
+    dist = -1;
+    for (int32_t i = 0; i < 15; i++) {
+        if (row_mask & (1 << i)) {
+            for (int32_t j = i + 1; j < 16; j++) {
+                temp = Distance(&block[i * 4], &block[j * 4]);
 
-    if (color_8_to_5[color[3]] == 0) {
-        return 3;
+                if (temp > dist) {
+                    dist = temp;
+                    *col1 = i;
+                    *col2 = j;
+                }
+            }
+        }
     }
-    dist = INT32_MAX;
-    best = 0;
+    return dist;
+}
+
+static void SelectIndicesCMPR(uint8_t *palette, int32_t count, uint8_t *block, int32_t *indices)
+{
+    int32_t dist, best, temp;
 
     for (int32_t i = 0; i < 16; i++) {
-        if (palette[(i * 4) + 3] != 255) {
-            break;
-        }
-        temp = Distance(&palette[i*4], color);
-        if (temp < dist) {
-            if (temp == 0) {
-                return i;
+        dist = INT32_MAX;
+        best = 0;
+        for (int32_t j = 0; j < count; j++) {
+            temp = Distance(&palette[j * 4], &block[i * 4]);
+            if (temp < dist) {
+                dist = temp;
+                best = j;
             }
-            dist = temp;
-            best = i;
         }
+        indices[i] = best;
     }
-    return best;
 }
 
-static void ConvertBlockCMPR(uint8_t *dst, uint8_t *block)
+CmprKernels GetCmprKernels(int level)
 {
-    int32_t col1, col2, dist, temp;
+    CmprKernels kernels = { FindEndpointsCMPR, SelectIndicesCMPR };
+#ifdef SIMD_X86
+    if (level == SIMD_LEVEL_AVX2) {
+        kernels.find_endpoints = FindEndpointsCMPR_AVX2;
+        kernels.select_indices = SelectIndicesCMPR_AVX2;
+    } else if (level == SIMD_LEVEL_SSE2) {
+        kernels.find_endpoints = FindEndpointsCMPR_SSE2;
+        kernels.select_indices = SelectIndicesCMPR_SSE2;
+    }
+#endif
+    return kernels;
+}
+
+//Index of the first pixel that differs from pixel 0 if the block has exactly two colors, otherwise -1
+static int32_t FindSecondColorCMPR(uint8_t *block)
+{
+    int32_t second = -1;
+    for (int32_t i = 1; i < 16; i++) {
+        if (memcmp(&block[i * 4], &block[0], 3) == 0) {
+            continue;
+        }
+        if (second == -1) {
+            second = i;
+        } else if (memcmp(&block[i * 4], &block[second * 4], 3) != 0) {
+            return -1;
+        }
+    }
+    return second;
+}
+
+static void ConvertBlockCMPR(uint8_t *dst, uint8_t *block, const CmprKernels &kernels)
+{
+    int32_t col1, col2, dist;
     bool alpha;
+    uint32_t row_mask;
     uint8_t palette[16];
 
-    dist = col1 = col2 = -1;
+    col1 = col2 = -1;
     alpha = false;
+    row_mask = 0;
 
+    //The last pixel is never checked for transparency
     for (int32_t i = 0; i < 15; i++) {
         if (block[i * 4 + 3] < 128) {
             alpha = true;
         } else {
-            for (int32_t j = i + 1; j < 16; j++) {
-                temp = Distance(&block[i * 4], &block[j * 4]);
-
-                if (temp > dist) {
-                    dist = temp;
-                    col1 = i;
-                    col2 = j;
-                }
+            row_mask |= 1 << i;
+        }
+    }
+    //Nothing visible gives the same block the search would
+    uint32_t transparent_mask = 0;
+    bool partial_alpha = false;
+    for (int32_t i = 0; i < 16; i++) {
+        if (color_8_to_5[block[(i * 4) + 3]] == 0) {
+            transparent_mask |= 1 << i;
+        } else if (block[(i * 4) + 3] < 128) {
+            partial_alpha = true;
+        }
+    }
+    if (transparent_mask == 0xFFFF) {
+        WriteU16Mem(&dst[0], 0x0000);
+        WriteU16Mem(&dst[2], 0xFFFF);
+        memset(&dst[4], 0xFF, 4);
+        return;
+    }
+    if (!partial_alpha) {
+        int32_t first = 0;
+        while (transparent_mask & (1 << first)) {
+            first++;
+        }
+        bool uniform = true;
+        for (int32_t i = first + 1; i < 16 && uniform; i++) {
+            if (!(transparent_mask & (1 << i)) && memcmp(&block[i * 4], &block[first * 4], 3) != 0) {
+                uniform = false;
             }
         }
+        if (uniform) {
+            EncodeSingleColorCMPR(dst, &block[first * 4], alpha, transparent_mask);
+            return;
+        }
+    }
+    //With only two colors the first pair the search finds is pixel 0 and the first pixel of the other color
+    int32_t second = (row_mask == 0x7FFF) ? FindSecondColorCMPR(block) : -1;
+    if (second != -1) {
+        col1 = 0;
+        col2 = second;
+        dist = Distance(&block[0], &block[second * 4]);
+    } else {
+        dist = kernels.find_endpoints(block, row_mask, &col1, &col2);
     }
     if (dist == -1) {
         palette[0] = 0;
@@ -432,81 +537,135 @@ static void ConvertBlockCMPR(uint8_t *dst, uint8_t *block)
         palette[11] = 255;
         palette[15] = 0;
     }
+    //Entries after the first non-opaque one are never picked
+    int32_t count = 0;
+    while (count < 4 && palette[(count * 4) + 3] == 255) {
+        count++;
+    }
+    int32_t indices[16];
+    kernels.select_indices(palette, count, block, indices);
+    for (int32_t i = 0; i < 16; i++) {
+        if (color_8_to_5[block[(i * 4) + 3]] == 0) {
+            indices[i] = 3;
+        }
+    }
     for (int i = 0; i < 4; i++)
     {
-        dst[4 + i] = LeastDistance(palette, &block[i*16]) << 6 | LeastDistance(palette, &block[(i * 16)+4]) << 4 | LeastDistance(palette, &block[(i * 16) + 8]) << 2 | LeastDistance(palette, &block[(i * 16) + 12]);
-    }
-}
-
-static void ConvertTextureCMPR(int32_t w, int32_t h, uint8_t *src, uint8_t *dst)
-{
-    for (int32_t i = 0; i < ((h + 7) / 8) * 8; i += 8) {
-        for (int32_t j = 0; j < ((w + 7) / 8) * 8; j += 8) {
-            int32_t block_pitch = (w + 7) / 8;
-            int32_t block_y_idx = i / 8;
-            int32_t block_x_idx = j / 8;
-            int32_t block_idx = (block_pitch * block_y_idx) + block_x_idx;
-            for (int32_t block_y = 0; block_y < 2; block_y++) {
-                for (int32_t block_x = 0; block_x < 2; block_x++) {
-                    uint8_t raw_block[64];
-                    uint32_t block_ofs = (block_idx * 32) + (((block_y * 2) + block_x) * 8);
-                    for (int32_t y = 0; y < 4; y++) {
-                        for (int32_t x = 0; x < 4; x++) {
-                            int32_t pixel_x = j + (block_x * 4) + x;
-                            int32_t pixel_y = i + (block_y * 4) + y;
-                            if (pixel_x >= w) {
-                                pixel_x = w - 1;
-                            }
-                            if (pixel_y >= h) {
-                                pixel_y = h - 1;
-                            }
-                            memcpy(&raw_block[((y * 4) + x) * 4], &src[((pixel_y * w) + pixel_x) * 4], 4);
+        dst[4 + i] = indices[i * 4] << 6 | indices[(i * 4) + 1] << 4 | indices[(i * 4) + 2] << 2 | indices[(i * 4) + 3];
+    }
+}
+
+static void EncodeBlockCMPR(uint8_t *dst, uint8_t *block, uint8_t quality, const CmprKernels &kernels)
+{
+    if (quality == CMPR_QUALITY_FAST) {
+        ConvertBlockCMPR(dst, block, kernels);
+    } else {
+        FitBlockCMPR(dst, block, quality, kernels);
+    }
+}
+
+static void ConvertTileRowCMPR(int32_t w, int32_t h, int32_t i, uint8_t *src, uint8_t *dst, uint8_t quality, const CmprKernels &kernels,
+    const EncodeOptions &options)
+{
+    for (int32_t j = 0; j < ((w + 7) / 8) * 8; j += 8) {
+        int32_t block_pitch = (w + 7) / 8;
+        int32_t block_y_idx = i / 8;
+        int32_t block_x_idx = j / 8;
+        int32_t block_idx = (block_pitch * block_y_idx) + block_x_idx;
+        for (int32_t block_y = 0; block_y < 2; block_y++) {
+            for (int32_t block_x = 0; block_x < 2; block_x++) {
+                uint8_t raw_block[64];
+                uint32_t block_ofs = (block_idx * 32) + (((block_y * 2) + block_x) * 8);
+                for (int32_t y = 0; y < 4; y++) {
+                    for (int32_t x = 0; x < 4; x++) {
+                        int32_t pixel_x = j + (block_x * 4) + x;
+                        int32_t pixel_y = i + (block_y * 4) + y;
+                        if (pixel_x >= w) {
+                            pixel_x = w - 1;
+                        }
+                        if (pixel_y >= h) {
+                            pixel_y = h - 1;
                         }
+                        memcpy(&raw_block[((y * 4) + x) * 4], &src[((pixel_y * w) + pixel_x) * 4], 4);
+                    }
+                }
+                EncodeBlockCMPR(&dst[block_ofs], raw_block, quality, kernels);
+                if (options.simd_verify && options.simd_level != SIMD_LEVEL_SCALAR) {
+                    uint8_t ref_block[8];
+                    EncodeBlockCMPR(ref_block, raw_block, quality, GetCmprKernels(SIMD_LEVEL_SCALAR));
+                    if (memcmp(ref_block, &dst[block_ofs], 8) != 0) {
+                        PrintError("%s CMPR output differs from scalar at pixel (%d, %d).\n", SimdDispatch::GetLevelName(options.simd_level),
+                            j + (block_x * 4), i + (block_y * 4));
                     }
-                    ConvertBlockCMPR(&dst[block_ofs], raw_block);
                 }
             }
         }
     }
 }
 
-void TextureWrite(FILE *file, uint8_t format, int32_t w, int32_t h, uint8_t *src)
+static void ConvertTextureCMPR(int32_t w, int32_t h, uint8_t *src, uint8_t *dst, uint8_t quality, const EncodeOptions &options)
+{
+    CmprKernels kernels = GetCmprKernels(options.simd_level);
+    //Every tile row writes its own part of dst so rows can be encoded in any order
+    ThreadPool::Get()->ParallelFor((h + 7) / 8, [&](uint32_t row) {
+        ConvertTileRowCMPR(w, h, row * 8, src, dst, quality, kernels, options);
+    });
+}
+
+void TextureEncode(uint8_t format, int32_t w, int32_t h, uint8_t *src, EncodedTexture &texture, uint8_t cmpr_quality, const EncodeOptions &options)
+{
+	texture.tex_data.assign(GetTexDataSize(format, w, h), 0);
+	texture.pal_data.assign(GetTexPalSize(format), 0);
+	TextureEncode(format, w, h, src, texture.pal_data.data(), texture.tex_data.data(), cmpr_quality, options);
+}
+
+void TextureEncodeCached(uint8_t format, int32_t w, int32_t h, uint8_t *src, EncodedTexture &texture, uint8_t cmpr_quality, const EncodeOptions &options)
+{
+	if (!TextureCache::IsEnabled(options)) {
+		TextureEncode(format, w, h, src, texture, cmpr_quality, options);
+		return;
+	}
+	TextureCacheKey key = TextureCache::MakeKey(format, cmpr_quality, w, h, src);
+	if (!TextureCache::Load(options, key, texture) || texture.pal_data.size() != GetTexPalSize(format)
+		|| texture.tex_data.size() != GetTexDataSize(format, w, h)) {
+		TextureEncode(format, w, h, src, texture, cmpr_quality, options);
+		TextureCache::Store(options, key, texture);
+	}
+}
+
+void TextureEncode(uint8_t format, int32_t w, int32_t h, uint8_t *src, uint8_t *pal_dst, uint8_t *tex_dst, uint8_t cmpr_quality,
+	const EncodeOptions &options)
 {
-	uint32_t data_size = GetTexDataSize(format, w, h);
-	uint8_t *dst = new uint8_t[data_size];
+	uint8_t *dst = tex_dst;
+	memset(dst, 0, GetTexDataSize(format, w, h));
 	switch (format) {
 		case TEX_FORMAT_RGBA8:
 			ConvertTextureRGBA8(w, h, src, dst);
 			break;
 
         case TEX_FORMAT_RGB5A3:
-            ConvertTextureRGB5A3(w, h, src, dst);
+            ConvertTextureRGB5A3(w, h, src, dst, options);
             break;
 
         case TEX_FORMAT_CI8:
-            ConvertTextureCI8(w, h, src, dst);
-            fwrite(pal_data, 2, 256, file);
-            break;
-
         case TEX_FORMAT_CI4:
-            ConvertTextureCI4(w, h, src, dst);
-            fwrite(pal_data, 2, 16, file);
+            ConvertTextureCI(format, w, h, src, pal_dst, dst, options);
             break;
 
         case TEX_FORMAT_IA8:
-            ConvertTextureIA8(w, h, src, dst);
+            ConvertTextureIA8(w, h, src, dst, options);
             break;
 
         case TEX_FORMAT_IA4:
-            ConvertTextureIA4(w, h, src, dst);
+            ConvertTextureIA4(w, h, src, dst, options);
             break;
 
         case TEX_FORMAT_I8:
-            ConvertTextureI8(w, h, src, dst);
+            ConvertTextureI8(w, h, src, dst, options);
             break;
 
         case TEX_FORMAT_I4:
-            ConvertTextureI4(w, h, src, dst);
+            ConvertTextureI4(w, h, src, dst, options);
             break;
 
         case TEX_FORMAT_A8:
@@ -514,13 +673,271 @@ void TextureWrite(FILE *file, uint8_t format, int32_t w, int32_t h, uint8_t *src
             break;
 
         case TEX_FORMAT_CMPR:
-            ConvertTextureCMPR(w, h, src, dst);
+            ConvertTextureCMPR(w, h, src, dst, cmpr_quality, options);
             break;
 
 		default:
 			PrintError("Invalid Texture Format %d.\n", format);
 			break;
 	}
-	fwrite(dst, 1, data_size, file);
-	delete[] dst;
+}
+
+static bool IsSameTexture(TextureSource &texture1, TextureSource &texture2)
+{
+    if (texture1.format != texture2.format || texture1.w != texture2.w || texture1.h != texture2.h || texture1.palette_group != texture2.palette_group) {
+        return false;
+    }
+    //CMPR quality is the only option changing the output of the same pixels
+    if (texture1.format == TEX_FORMAT_CMPR && texture1.cmpr_quality != texture2.cmpr_quality) {
+        return false;
+    }
+    return texture1.data == texture2.data || !memcmp(texture1.data, texture2.data, (size_t)texture1.w * texture1.h * 4);
+}
+
+std::vector<uint32_t> FindDuplicateTextures(std::vector<TextureSource> &textures)
+{
+    std::vector<uint64_t> hashes(textures.size());
+    ThreadPool::Get()->ParallelFor(textures.size(), [&](uint32_t i) {
+        hashes[i] = HashData(textures[i].data, (size_t)textures[i].w * textures[i].h * 4, 0);
+    });
+    std::unordered_map<uint64_t, std::vector<uint32_t>> hash_textures;
+    std::vector<uint32_t> owners(textures.size());
+    for (uint32_t i = 0; i < textures.size(); i++) {
+        owners[i] = i;
+        std::vector<uint32_t> &candidates = hash_textures[hashes[i]];
+        for (size_t j = 0; j < candidates.size(); j++) {
+            if (IsSameTexture(textures[candidates[j]], textures[i])) {
+                owners[i] = candidates[j];
+                break;
+            }
+        }
+        if (owners[i] == i) {
+            candidates.push_back(i);
+        }
+    }
+    return owners;
+}
+
+//Counts bands of rows on separate threads and feeds them in order, giving the same histogram as one exq_feed
+static void FeedHistogram(exq_data *exq_data, int32_t w, int32_t h, uint8_t *src)
+{
+    int32_t band_rows = FEED_BAND_PIXELS / w;
+    if (band_rows < 1) {
+        band_rows = 1;
+    }
+    uint32_t num_bands = (h + band_rows - 1) / band_rows;
+    if (num_bands <= 1) {
+        exq_feed(exq_data, src, w * h);
+        return;
+    }
+    std::vector<exq_partial *> partials(num_bands);
+    ThreadPool::Get()->ParallelFor(num_bands, [&](uint32_t i) {
+        int32_t num_rows = std::min(band_rows, h - (int32_t)(i * band_rows));
+        partials[i] = exq_partial_init(w * num_rows);
+        exq_partial_feed(partials[i], &src[(size_t)i * band_rows * w * 4], w * num_rows);
+    });
+    //Merge neighbouring bands in parallel rounds so colors stay in order of first appearance
+    while (partials.size() > 1) {
+        std::vector<exq_partial *> merged((partials.size() + 1) / 2);
+        ThreadPool::Get()->ParallelFor((uint32_t)merged.size(), [&](uint32_t i) {
+            if (i * 2 + 1 < partials.size()) {
+                merged[i] = exq_partial_merge(partials[i * 2], partials[i * 2 + 1]);
+                exq_partial_free(partials[i * 2]);
+                exq_partial_free(partials[i * 2 + 1]);
+            } else {
+                merged[i] = partials[i * 2];
+            }
+        });
+        partials.swap(merged);
+    }
+    exq_feed_partials(exq_data, partials.data(), 1);
+    exq_partial_free(partials[0]);
+}
+
+void TextureEncodeGroup(std::vector<TextureSource> &textures, uint8_t *pal_dst, std::vector<uint8_t *> &tex_dsts, const EncodeOptions &options)
+{
+    uint8_t format = textures[0].format;
+    int32_t num_colors = 1 << GetTexBpp(format);
+    std::vector<std::vector<uint8_t>> data_bufs(textures.size());
+    std::vector<uint8_t *> index_dsts;
+    for (size_t i = 0; i < textures.size(); i++) {
+        data_bufs[i].resize(textures[i].w * textures[i].h);
+        index_dsts.push_back(data_bufs[i].data());
+    }
+    if (!FindExactPalette(textures, num_colors, pal_dst, index_dsts, options)) {
+        uint8_t *pal_buf = new uint8_t[num_colors * 4]();
+        exq_data *exq_data = exq_init();
+        for (size_t i = 0; i < textures.size(); i++) {
+            FeedHistogram(exq_data, textures[i].w, textures[i].h, textures[i].data);
+        }
+        exq_quantize_hq(exq_data, num_colors);
+        exq_get_palette(exq_data, pal_buf, num_colors);
+        ConvertRGB5A3Buffer(num_colors, 1, pal_buf, pal_dst, options);
+        for (size_t i = 0; i < textures.size(); i++) {
+            exq_map_image_ordered(exq_data, textures[i].w, textures[i].h, textures[i].data, index_dsts[i]);
+        }
+        exq_free(exq_data);
+        delete[] pal_buf;
+    }
+    for (size_t i = 0; i < textures.size(); i++) {
+        int32_t w = textures[i].w;
+        int32_t h = textures[i].h;
+        memset(tex_dsts[i], 0, GetTexDataSize(format, w, h));
+        if (format == TEX_FORMAT_CI8) {
+            TileEncoder<TEX_FORMAT_CI8>::Encode<1>(w, h, index_dsts[i], tex_dsts[i], [](uint8_t *index) {
+                return *index;
+            });
+        } else {
+            TileEncoder<TEX_FORMAT_CI4>::Encode<1>(w, h, index_dsts[i], tex_dsts[i], [](uint8_t *index) {
+                return *index;
+            });
+        }
+    }
+}
+
+int32_t FindPaletteGroup(std::vector<PaletteGroup> &groups, std::string name, uint8_t format)
+{
+    if (name.empty()) {
+        return -1;
+    }
+    if (format != TEX_FORMAT_CI8 && format != TEX_FORMAT_CI4) {
+        PrintError("Palette group %s can only contain CI4 and CI8 textures.\n", name.c_str());
+    }
+    for (size_t i = 0; i < groups.size(); i++) {
+        if (groups[i].name == name) {
+            if (groups[i].format != format) {
+                PrintError("Palette group %s mixes CI4 and CI8 textures.\n", name.c_str());
+            }
+            return (int32_t)i;
+        }
+    }
+    PaletteGroup group;
+    group.name = name;
+    group.format = format;
+    groups.push_back(group);
+    return (int32_t)groups.size() - 1;
+}
+
+uint32_t PlanPaletteSection(LayoutPlan &layout, std::vector<TextureSource> &textures, uint32_t index, std::string name, PaletteGroupSections &group_sections)
+{
+    int32_t group = textures[index].palette_group;
+    uint32_t pal_size = GetTexPalSize(textures[index].format);
+    if (group < 0) {
+        return layout.AddSection(name, pal_size);
+    }
+    if ((size_t)group >= group_sections.sections.size()) {
+        group_sections.sections.resize(group + 1, 0);
+    }
+    if (GetSourcePalSize(textures, index) == 0) {
+        group_sections.num_shared++;
+        group_sections.saved_size += pal_size;
+    } else {
+        group_sections.sections[group] = layout.AddSection(name, pal_size);
+    }
+    return group_sections.sections[group];
+}
+
+uint32_t GetSourcePalSize(std::vector<TextureSource> &textures, uint32_t index)
+{
+    int32_t group = textures[index].palette_group;
+    if (group >= 0) {
+        for (uint32_t i = 0; i < index; i++) {
+            if (textures[i].palette_group == group) {
+                return 0;
+            }
+        }
+    }
+    return GetTexPalSize(textures[index].format);
+}
+
+//Encodes a palette group as one unit, its cache entry holds the palette and every member's data back to back
+static void WriteTextureGroup(std::vector<TextureSource> &textures, std::vector<uint32_t> &members, uint8_t *dst, std::vector<size_t> &pal_ofs,
+    const EncodeOptions &options)
+{
+    std::vector<TextureSource> sources;
+    std::vector<uint8_t *> tex_dsts;
+    std::vector<TextureCacheKey> keys;
+    uint32_t pal_size = GetTexPalSize(textures[members[0]].format);
+    uint32_t tex_size = 0;
+    for (size_t i = 0; i < members.size(); i++) {
+        TextureSource &texture = textures[members[i]];
+        sources.push_back(texture);
+        tex_dsts.push_back(&dst[pal_ofs[members[i]] + GetSourcePalSize(textures, members[i])]);
+        tex_size += GetTexDataSize(texture.format, texture.w, texture.h);
+    }
+    uint8_t *pal_dst = &dst[pal_ofs[members[0]]];
+    if (!TextureCache::IsEnabled(options)) {
+        TextureEncodeGroup(sources, pal_dst, tex_dsts, options);
+        return;
+    }
+    for (size_t i = 0; i < sources.size(); i++) {
+        keys.push_back(TextureCache::MakeKey(sources[i].format, sources[i].cmpr_quality, sources[i].w, sources[i].h, sources[i].data));
+    }
+    TextureCacheKey key = TextureCache::CombineKeys(keys);
+    EncodedTexture encoded;
+    if (!TextureCache::Load(options, key, encoded) || encoded.pal_data.size() != pal_size || encoded.tex_data.size() != tex_size) {
+        encoded.pal_data.assign(pal_size, 0);
+        encoded.tex_data.assign(tex_size, 0);
+        std::vector<uint8_t *> encoded_dsts;
+        uint8_t *encoded_dst = encoded.tex_data.data();
+        for (size_t i = 0; i < sources.size(); i++) {
+            encoded_dsts.push_back(encoded_dst);
+            encoded_dst += GetTexDataSize(sources[i].format, sources[i].w, sources[i].h);
+        }
+        TextureEncodeGroup(sources, encoded.pal_data.data(), encoded_dsts, options);
+        TextureCache::Store(options, key, encoded);
+    }
+    memcpy(pal_dst, encoded.pal_data.data(), pal_size);
+    uint8_t *encoded_src = encoded.tex_data.data();
+    for (size_t i = 0; i < sources.size(); i++) {
+        uint32_t size = GetTexDataSize(sources[i].format, sources[i].w, sources[i].h);
+        memcpy(tex_dsts[i], encoded_src, size);
+        encoded_src += size;
+    }
+}
+
+void TextureWriteAll(ByteWriter &writer, std::vector<TextureSource> &textures, const EncodeOptions &options)
+{
+	std::vector<size_t> pal_ofs(textures.size());
+	std::vector<std::vector<uint32_t>> groups;
+	std::unordered_map<int32_t, size_t> group_indices;
+	size_t total_size = 0;
+	for (uint32_t i = 0; i < textures.size(); i++) {
+		pal_ofs[i] = total_size;
+		total_size += GetSourcePalSize(textures, i) + GetTexDataSize(textures[i].format, textures[i].w, textures[i].h);
+		if (textures[i].palette_group >= 0) {
+			if (group_indices.find(textures[i].palette_group) == group_indices.end()) {
+				group_indices[textures[i].palette_group] = groups.size();
+				groups.push_back(std::vector<uint32_t>());
+			}
+			groups[group_indices[textures[i].palette_group]].push_back(i);
+		}
+	}
+	//Every texture owns a disjoint part of the output so threads can fill them in place
+	uint8_t *dst = writer.Allocate(total_size);
+	ThreadPool::Get()->ParallelFor(groups.size(), [&](uint32_t i) {
+		WriteTextureGroup(textures, groups[i], dst, pal_ofs, options);
+	});
+	ThreadPool::Get()->ParallelFor(textures.size(), [&](uint32_t i) {
+		if (textures[i].palette_group >= 0) {
+			return;
+		}
+		uint32_t pal_size = GetTexPalSize(textures[i].format);
+		uint32_t tex_size = GetTexDataSize(textures[i].format, textures[i].w, textures[i].h);
+		uint8_t *pal_dst = &dst[pal_ofs[i]];
+		uint8_t *tex_dst = pal_dst + pal_size;
+		if (textures[i].encoded && textures[i].encoded->pal_data.size() == pal_size && textures[i].encoded->tex_data.size() == tex_size) {
+			memcpy(pal_dst, textures[i].encoded->pal_data.data(), pal_size);
+			memcpy(tex_dst, textures[i].encoded->tex_data.data(), tex_size);
+			return;
+		}
+		if (!TextureCache::IsEnabled(options)) {
+			TextureEncode(textures[i].format, textures[i].w, textures[i].h, textures[i].data, pal_dst, tex_dst, textures[i].cmpr_quality, options);
+			return;
+		}
+		EncodedTexture encoded;
+		TextureEncodeCached(textures[i].format, textures[i].w, textures[i].h, textures[i].data, encoded, textures[i].cmpr_quality, options);
+		memcpy(pal_dst, encoded.pal_data.data(), pal_size);
+		memcpy(tex_dst, encoded.tex_data.data(), tex_size);
+	});
 }
\ No newline at end of file
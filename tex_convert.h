@@ -0,0 +1,13 @@
+#pragma once
+
+#include <stdint.h>
+
+//Shared by the texture encoders and the texture benchmark
+extern uint8_t color_8_to_3[256];
+extern uint8_t color_8_to_4[256];
+extern uint8_t color_8_to_5[256];
+extern uint8_t color_8_to_6[256];
+
+uint8_t GetIntensity(uint8_t *color);
+uint16_t EncodeRGB5A3(uint8_t *color);
+void ConvertColorRGB5A3(uint8_t *dst, uint8_t *color);